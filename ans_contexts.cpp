@@ -81,4 +81,119 @@ void Context::free() {
 	case 6: u.c6.free(); break;
 	case 7: u.c7.free(); break;
 	}
-}
\ No newline at end of file
+}
+
+size_t Context::heapBytes() const {
+	switch(u.c1.kind) {
+	case 2: return sizeof(SymbolList<64>);
+	case 3: return sizeof(SymbolList<256>);
+	case 5: return sizeof(SmallContext<Cx5::maxD>);
+	case 6: return u.c6.S * (sizeof(BYTE) + sizeof(Freq) + sizeof(uint16_t)) + sizeof(uint16_t);
+	case 7: return sizeof(BigContext<256>) + (u.c7.decTable ? PROB_SCALE / Cx7::D : 0);
+	}
+	return 0;
+}
+
+static BYTE* PutVarint(BYTE *p, uint v)
+{
+	while(v >= 128) {
+		*p++ = (v & 127) | 128;
+		v >>= 7;
+	}
+	*p++ = v;
+	return p;
+}
+
+static BYTE* GetVarint(BYTE *p, BYTE *end, uint &v)
+{
+	v = 0;
+	for(int shift=0; p < end && shift < 32; shift += 7) {
+		const uint b = *p++;
+		v |= (b & 127) << shift;
+		if (b < 128) return p;
+	}
+	return NULL;
+}
+
+void StaticRansCtx::build(const uint *cnt, int nsym)
+{
+	memset(freq, 0, sizeof(freq));
+	memset(cumFreq, 0, sizeof(cumFreq));
+	unsigned long long total = 0;
+	for(int s=0; s<nsym; s++)
+		total += cnt[s];
+	if (total==0) return;
+	int sum = 0;
+	for(int s=0; s<nsym; s++)
+		if (cnt[s]) {
+			freq[s] = max((int)(cnt[s] * (unsigned long long)PROB_SCALE / total), 1);
+			sum += freq[s];
+		}
+	while(sum != PROB_SCALE) { //rounding down gives less, raising rare symbols to 1 may give more
+		int top = 0;
+		for(int s=1; s<nsym; s++)
+			if (freq[s] > freq[top]) top = s;
+		const int d = sum < PROB_SCALE ? PROB_SCALE - sum : -min(sum - PROB_SCALE, freq[top] - 1);
+		freq[top] += d;
+		sum += d;
+	}
+	int cf = 0;
+	for(int s=0; s<nsym; s++) {
+		cumFreq[s] = cf;
+		cf += freq[s];
+	}
+}
+
+//k symbols met, then one symbol if k=1, otherwise for each symbol its distance from previous one
+//and frequency, except the last one taking the rest
+BYTE* StaticRansCtx::write(BYTE *p, int nsym) const
+{
+	int k = 0;
+	for(int s=0; s<nsym; s++)
+		if (freq[s]) k++;
+	p = PutVarint(p, k);
+	int prev = -1, j = 0;
+	for(int s=0; s<nsym; s++)
+		if (freq[s]) {
+			*p++ = s - prev - 1;
+			prev = s;
+			if (++j < k) p = PutVarint(p, freq[s]);
+		}
+	return p;
+}
+
+BYTE* StaticRansCtx::read(BYTE *p, BYTE *end, int nsym)
+{
+	memset(freq, 0, sizeof(freq));
+	memset(cumFreq, 0, sizeof(cumFreq));
+	uint k;
+	p = GetVarint(p, end, k);
+	if (!p || k > (uint)nsym) return NULL;
+	int prev = -1, sum = 0;
+	for(uint j=0; j<k; j++) {
+		if (p >= end) return NULL;
+		const int s = prev + 1 + *p++;
+		if (s >= nsym) return NULL;
+		uint f = PROB_SCALE - sum;
+		if (j+1 < k) {
+			p = GetVarint(p, end, f);
+			if (!p || f==0 || sum + f >= PROB_SCALE) return NULL;
+		}
+		freq[s] = f;
+		sum += f;
+		prev = s;
+	}
+	int cf = 0;
+	for(int s=0; s<nsym; s++) {
+		cumFreq[s] = cf;
+		cf += freq[s];
+	}
+	return p;
+}
+
+void StaticRansCtx::makeSlots()
+{
+	for(int s=0; s<256; s++)
+		if (freq[s])
+			memset(&slot[cumFreq[s]], s, freq[s]);
+}
@@ -3,11 +3,20 @@
 
 #include <vector>
 #include <algorithm>
+#include <type_traits>
 #include <assert.h>
 #include <stdint.h>
 #include "defines.h"
 #include "logging.h"
 
+//SSE2 is always there in x64 and is the default target of 32-bit builds since VS2012.
+//Define SC_NO_SIMD to build the scalar searches, e.g. to compare their speed in scprmicro.
+#if !defined(SC_NO_SIMD) && (defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SC_SSE2
+#include <emmintrin.h>
+#include <intrin.h>
+#endif
+
 /*
 Here we define several kinds of "contexts", statistical models that record how many times
 each symbol was seen in given context and assign intervals [a,b) to each symbol
@@ -66,6 +75,10 @@ struct Freq {
 #define PROB_BITS 12
 #define PROB_SCALE (1 << PROB_BITS)
 
+//Precision of FixedSizeRansCtx models in bitstream v6 and of all intervals coded there,
+//colour context intervals get scaled up. Still fits Freq: cumFreq + freq <= 1<<15.
+#define PROB_BITS_FX 15
+
 enum FindRes { Found, Added, NoRoom };
 
 //used in contexts where no symbol appeared twice yet
@@ -282,6 +295,7 @@ struct SmallContext {
 		return true;
 	}//decode
 
+
 	void show() { 
 		lprintf(logF,"d=%d maxpos=%d [", d, maxpos);
 		for(int i=0;i<d;i++) lprintf(logF,"%d:%d ", symbols[i], freqs[i]);
@@ -494,9 +508,11 @@ struct Cx6 {
 		init(S0);
 		const int mask = S0-1, f0 = GetThreadLocalInt(); // 32 for v4.0;  v3.0 had f0=64
 		int oldd = cx.d; // up to 64
+		int f = f0; //v3 f0=64 overflows the scale from 60 symbols on, such contexts start lower
+		while (256 - oldd + oldd * f + f > PROB_SCALE) f >>= 1;
 
 		int totFr = 256 - oldd;
-		totFr += oldd * f0 + f0; // +f0 for the c which is met 2nd time
+		totFr += oldd * f + f; // +f for the c which is met 2nd time
 		d = 0;
 		assert(totFr <= PROB_SCALE);
 
@@ -515,7 +531,7 @@ struct Cx6 {
 			int startFr = cumFr + s - lastSymb;
 
 			cumFr += s - lastSymb;
-			cfr = s==c ? f0*2 : f0;
+			cfr = s==c ? f*2 : f;
 			Freq interval;
 			interval.cumFreq = cumFr << shift;	interval.freq = cfr << shift;
 			lprintf(logF, "  pos=%d s=%d startFr=%d cumFr=%d cfr=%d\n", pos, s, startFr, cumFr, cfr);
@@ -704,6 +720,29 @@ struct Cx6 {
 
 	bool decode(int someFreq, BYTE &c, Freq & interval) {
 		Freq lfr = {0,0}; BYTE lowerSym = 0;
+#ifdef SC_SSE2
+		//4 intervals at once, {freq, cumFreq} is one 32-bit lane; S is a multiple of 4
+		//and entries from d on have zero freq, so they never match
+		const __m128i v = _mm_set1_epi32(someFreq), lo16 = _mm_set1_epi32(0xFFFF), minus1 = _mm_set1_epi32(-1);
+		for(int i=0;i<d;i+=4) {
+			const __m128i fr = _mm_loadu_si128((const __m128i*)(freqs + i));
+			const __m128i x = _mm_sub_epi32(v, _mm_srli_epi32(fr, 16)); //someFreq - cumFreq
+			const int found = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi32(x, minus1), _mm_cmpgt_epi32(_mm_and_si128(fr, lo16), x)));
+			if (found) {
+				unsigned long bit;
+				_BitScanForward(&bit, found);
+				const int pos = i + bit / 4;
+				c = symbols[pos]; interval = freqs[pos];
+				incrCntDec(pos); return true;
+			}
+		}
+		for(int i=0;i<d;i++) { //not found, a new symbol follows the closest lower one
+			int cf = freqs[i].cumFreq;
+			if (cf <= someFreq && cf >= lfr.cumFreq) {
+				lfr = freqs[i]; lowerSym = symbols[i];
+			}
+		}
+#else
 		for(int i=0;i<d;i++) {
 			int cf = freqs[i].cumFreq;
 			if (cf <= someFreq) {
@@ -716,6 +755,7 @@ struct Cx6 {
 				}
 			}
 		}
+#endif
 		//symbol not in table
 		Freq fr;
 		fr.freq = 1 << fshift;
@@ -844,13 +884,15 @@ struct BigContext {
 //For decoding, have an array for mapping range values to symbols, but decimated,
 //so to find the symbol and interval corresponding to some range value,
 //scale it down, look up in decTable, then from that value search forward.
+//Thousands of contexts may get this kind, so unlike FixedSizeRansCtx the array is not full:
+//4 KB per context made decoding of noisy video slower, 256 bytes leave ~1 step of search.
 struct Cx7 {
 	BYTE kind;
 	int cntsum;
 	BigContext<256> *cxdata;
-	BYTE *decTable; //cumFreq / D => symbol; for Dshift=7 decTable is just 32 bytes
+	BYTE *decTable; //cumFreq / D => symbol; for Dshift=4 decTable is 256 bytes
 	static const int step = STEP_CX7;
-	static const int Dshift = 7; 
+	static const int Dshift = 4; 
 	static const int D = 1 << Dshift;
 
 	void init(bool decoding) {
@@ -865,6 +907,15 @@ struct Cx7 {
 		delete[] decTable; decTable = NULL;	
 	}
 
+	//decTable entries of values cf..cf+fr-1 point to sym
+	void setSlots(int cf, int fr, int sym) {
+		if (fr <= 0) return;
+		const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = D*k
+		const int k1 = min(((cf + fr - 1) >> Dshift) + 1, PROB_SCALE >> Dshift);
+		if (k0 < k1) //v3 contexts (f0=64) may hand over intervals past the scale
+			std::fill(decTable + k0, decTable + k1, (BYTE)sym);
+	}
+
 	void create(const Cx6 &c6, BYTE c, bool decoding) {
 		init(decoding);
 		cntsum = c6.cnts[c6.S];
@@ -900,18 +951,14 @@ struct Cx7 {
 
 				assert(cxdata->freqs[i].cumFreq <= PROB_SCALE);
 			}
-			if (decoding) {
-				//for(int j=cumFr; j<cumFr + fr; j++)
-				//	if ((j & (D-1)) == 0) decTable[j >> Dshift] = i;
-				const int k0 = (cumFr + D-1) >> Dshift;//first z >= cf, such that z = D*k
-				const int k1 = ((cumFr + fr - 1) >> Dshift) + 1;
-				for(int k=k0; k<k1; k++)
-					decTable[k] = i;
-			}
+			if (decoding)
+				setSlots(cumFr, fr, i);
 			cumFr += fr;
 		}
 		assert(cumFr <= PROB_SCALE);
 		assert(cntsum <= PROB_SCALE);
+		if (decoding)
+			setSlots(cumFr, PROB_SCALE - cumFr, 255);
 	}
 
 	void create(Cx3 &c3, BYTE c, bool decoding) {
@@ -936,18 +983,14 @@ struct Cx7 {
 			cxdata->freqs[i].cumFreq = cf;
 			assert(cxdata->freqs[i].cumFreq <= PROB_SCALE);
 			int fr = cxdata->freqs[i].freq;
-			if (decoding) {
-				//for(int j=cf; j<cf + fr; j++)
-				//	if ((j & (D-1)) == 0) decTable[j >> Dshift] = i;
-				const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = D*k
-				const int k1 = ((cf + fr - 1) >> Dshift) + 1;
-				for(int k=k0; k<k1; k++)
-					decTable[k] = i;
-			}
+			if (decoding)
+				setSlots(cf, fr, i);
 			cf += fr;
 		}
 		assert(cf <= PROB_SCALE);
 		assert(cntsum <= PROB_SCALE);
+		if (decoding)
+			setSlots(cf, PROB_SCALE - cf, 255);
 	}
 
 	void encode(BYTE c, Freq &interval) {
@@ -965,35 +1008,25 @@ struct Cx7 {
 			for(int j=0;j<256;j++) {
 				cxdata->freqs[j].cumFreq = cf;
 				int fr = cxdata->freqs[j].freq = cxdata->cnts[j];
-				if (decoding) {
-					const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = D*k
-					const int k1 = ((cf + fr - 1) >> Dshift) + 1;
-					//for(int z=cf; z<cf + fr; z++)
-					//	if ((z & 7) == 0) decTable[z >> 3] = j;
-					for(int k=k0; k<k1; k++)
-						decTable[k] = j;
-				}
+				if (decoding)
+					setSlots(cf, fr, j);
 				cf += fr;
 				cxdata->cnts[j] -= fr >> 1;
 				cntsum += cxdata->cnts[j];
 			}
+			if (decoding)
+				setSlots(cf, PROB_SCALE - cf, 255);
 		}
 	}
 
 	void decode(int someFreq, BYTE &c, Freq & interval) {
-		int c0 = decTable[someFreq >> Dshift];
-		for(int j=c0; j<255; j++) {
-			assert(cxdata->freqs[j].cumFreq <= someFreq); //should be true by design
-			assert(cxdata->freqs[j].cumFreq + cxdata->freqs[j].freq == cxdata->freqs[j+1].cumFreq);
-			if (cxdata->freqs[j+1].cumFreq > someFreq) {
-				c = j; interval = cxdata->freqs[j];					
-				incrCnt<true>(c);
-				return;
-			}
-		}
-		//if we're here then c = 255
-		c = 255; interval = cxdata->freqs[255];					
-		incrCnt<true>(255);
+		int j = decTable[someFreq >> Dshift];
+		if (D > 1) //coarse table gives the first candidate, search forward
+			while (j < 255 && cxdata->freqs[j+1].cumFreq <= someFreq)
+				j++;
+		assert(cxdata->freqs[j].cumFreq <= someFreq); //should be true by design
+		c = j; interval = cxdata->freqs[j];
+		incrCnt<true>(c);
 	}
 };
 
@@ -1021,6 +1054,7 @@ public:
 
 	Context() { u.c1.kind = 0; }
 	int kind() const { return u.c1.kind; }
+	size_t heapBytes() const; //allocated by current kind, 0 when stored inside
 	bool encode(BYTE c, Freq &interval); // also updates stats, false means Skip, write raw byte
     bool decode(int someFreq, BYTE &c, Freq & interval);  // updates stats, if true returns c and interval                     
 
@@ -1050,15 +1084,18 @@ public:
 	void renew() { free(); u.c1.kind = 0; }
 };
 
-template<int NSym>
+//NSym symbols with counters, intervals out of 1<<Bits
+template<int NSym, int Bits = PROB_BITS>
 struct FixedSizeRansCtx {
-	static const int step = STEP_FX; 
-	static const int Dshift = 7; 
+	static const int Scale = 1 << Bits;
+	static const int step = STEP_FX << (Bits - PROB_BITS); //same adaptation speed with any precision
+	static const int Dshift = Bits - PROB_BITS; //full table at 12 bits, symbol is found by one lookup
 	static const int D = 1 << Dshift;
+	typedef typename std::conditional<(NSym > 256), uint16_t, BYTE>::type Slot;
 
 	int cntsum;
 	BigContext<NSym> cxdata; // Nsym * 6 bytes, 1.5k for NSym=256
-	BYTE decTable[PROB_SCALE / D]; //32 bytes for current values of PROB_SCALE=4k and Dshift=7
+	Slot decTable[Scale / D]; //4k entries, finer tables of higher precision would cost 32k per context
 
 	void encode(int c, Freq &interval) {
 		assert(c >= 0);
@@ -1067,67 +1104,88 @@ struct FixedSizeRansCtx {
 		incrCnt<false>(c);
 	}
 
+	//decTable entries of values cf..cf+fr-1 point to sym
+	void setSlots(int cf, int fr, int sym) {
+		if (fr <= 0) return;
+		const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = D*k
+		const int k1 = min(((cf + fr - 1) >> Dshift) + 1, Scale >> Dshift);
+		if (k0 < k1) //parts past the scale are never decoded
+			std::fill(decTable + k0, decTable + k1, (Slot)sym);
+	}
+
 	template<bool decoding>
 	void incrCnt(int c) {
 		assert(c >= 0);
 		assert(c < NSym);
 		cxdata.cnts[c] += step; cntsum += step;
-		if (cntsum + step > PROB_SCALE) {
+		if (cntsum + step > Scale) {
 			cntsum = 0; int cf = 0;
 			for(int j=0;j<NSym;j++) {
 				cxdata.freqs[j].cumFreq = cf;
 				int fr = cxdata.freqs[j].freq = cxdata.cnts[j];
-				if (decoding) {
-					const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = 8*k
-					const int k1 = ((cf + fr - 1) >> Dshift) + 1;
-					for(int k=k0; k<k1; k++)
-						decTable[k] = j;
-				}
+				if (decoding)
+					setSlots(cf, fr, j);
 				cf += fr;
 				cxdata.cnts[j] -= fr >> 1;
 				cntsum += cxdata.cnts[j];
 			}
+			if (decoding)
+				setSlots(cf, Scale - cf, NSym-1);
 		}
 	}
 
 	int decode(int someFreq, Freq & interval) {
 		assert(someFreq >= 0);
-		assert(someFreq < PROB_SCALE);
-		int c0 = decTable[someFreq >> Dshift];
-		assert(c0 >= 0);
-		assert(c0 < NSym);
-		for(int j=c0; j<NSym-1; j++) {
-			assert(cxdata.freqs[j].cumFreq <= someFreq); //should be true by design
-			assert(cxdata.freqs[j].cumFreq + cxdata.freqs[j].freq == cxdata.freqs[j+1].cumFreq);
-			if (cxdata.freqs[j+1].cumFreq > someFreq) {
-				interval = cxdata.freqs[j];					
-				incrCnt<true>(j);
-				return j;
-			}
-		}
-		//if we're here then c = last symbol
-		interval = cxdata.freqs[NSym-1];					
-		incrCnt<true>(NSym-1);
-		return NSym-1;
+		assert(someFreq < Scale);
+		int j = decTable[someFreq >> Dshift];
+		assert(j >= 0);
+		assert(j < NSym);
+		if (D > 1) //coarse table gives the first candidate, search forward
+			while (j < NSym-1 && cxdata.freqs[j+1].cumFreq <= someFreq)
+				j++;
+		assert(cxdata.freqs[j].cumFreq <= someFreq); //should be true by design
+		interval = cxdata.freqs[j];
+		incrCnt<true>(j);
+		return j;
 	}
 
 	void renew(bool decoding) { //set equal probs
 		int cf = 0;
-		const int fr = PROB_SCALE / NSym;
+		const int fr = Scale / NSym;
 		const int c0 = fr - (fr >> 1);
 		cntsum = c0 * NSym;
 		for(int i=0;i<NSym;i++) {
 			cxdata.freqs[i].freq = fr;
 			cxdata.freqs[i].cumFreq = cf;
 			cxdata.cnts[i] = c0;
-			if (decoding) {
-				const int k0 = (cf + D-1) >> Dshift;//first z >= cf, such that z = 8*k
-				const int k1 = ((cf + fr - 1) >> Dshift) + 1;
-				for(int k=k0; k<k1; k++)
-					decTable[k] = i;
-			}
+			if (decoding)
+				setSlots(cf, fr, i);
 			cf += fr;
 		}
+		if (decoding)
+			setSlots(cf, Scale - cf, NSym-1);
+	}
+};
+
+//Model of one context in I-frames coded in independent bands (v6): intervals out of
+//PROB_SCALE made from symbol counts of the whole frame and sent in it before coded data.
+//Nothing changes while coding, so bands can be coded in parallel.
+struct StaticRansCtx {
+	uint16_t freq[256], cumFreq[256]; //freq=0 for symbols not met
+	BYTE slot[PROB_SCALE]; //symbol of each cumulative frequency, filled by makeSlots() for decoding
+
+	void build(const uint *cnt, int nsym); //from symbol counts, all zero counts make empty context
+	BYTE* write(BYTE *p, int nsym) const; //number of symbols met, their gaps and frequencies
+	BYTE* read(BYTE *p, BYTE *end, int nsym); //NULL when data is broken
+	void makeSlots();
+
+	void encode(int c, Freq &interval) const {
+		interval.freq = freq[c]; interval.cumFreq = cumFreq[c];
+	}
+	int decode(int someFreq, Freq &interval) const {
+		const int c = slot[someFreq];
+		encode(c, interval);
+		return c;
 	}
 };
 
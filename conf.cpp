@@ -37,6 +37,16 @@ void Configuration::WriteValues()
 	RegSetValueEx(hkSub, "ForceInterval", 0, REG_DWORD, (BYTE*)&ForceInterval, 4);
 	RegSetValueEx(hkSub, "ForceLoss", 0, REG_DWORD, (BYTE*)&ForceLoss, 4);
 	RegSetValueEx(hkSub, "Loss", 0, REG_DWORD, (BYTE*)&loss, 4);
+	RegSetValueEx(hkSub, "TileSize", 0, REG_DWORD, (BYTE*)&TileSize, 4);
+	RegSetValueEx(hkSub, "Preset", 0, REG_DWORD, (BYTE*)&Preset, 4);
+	RegSetValueEx(hkSub, "Threads", 0, REG_DWORD, (BYTE*)&Threads, 4);
+	RegSetValueEx(hkSub, "MaxBitrate", 0, REG_DWORD, (BYTE*)&MaxBitrate, 4);
+	RegSetValueEx(hkSub, "AdaptiveLoss", 0, REG_DWORD, (BYTE*)&AdaptiveLoss, 4);
+	RegSetValueEx(hkSub, "KeepAlpha", 0, REG_DWORD, (BYTE*)&KeepAlpha, 4);
+	RegSetValueEx(hkSub, "BitStats", 0, REG_DWORD, (BYTE*)&BitStats, 4);
+	RegSetValueEx(hkSub, "Trace", 0, REG_DWORD, (BYTE*)&Trace, 4);
+	RegSetValueEx(hkSub, "StaticKeyFrames", 0, REG_DWORD, (BYTE*)&StaticKeyFrames, 4);
+	RegSetValueEx(hkSub, "BitstreamV6", 0, REG_DWORD, (BYTE*)&BitstreamV6, 4);
 }
 
 void Configuration::GetCurConfig()
@@ -75,6 +85,66 @@ void Configuration::GetCurConfig()
 		loss = 0;	
 	}
 
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "TileSize", 0, 0, (BYTE*)&TileSize, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		TileSize = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "Preset", 0, 0, (BYTE*)&Preset, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		Preset = 2;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "Threads", 0, 0, (BYTE*)&Threads, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		Threads = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "MaxBitrate", 0, 0, (BYTE*)&MaxBitrate, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		MaxBitrate = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "AdaptiveLoss", 0, 0, (BYTE*)&AdaptiveLoss, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		AdaptiveLoss = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "KeepAlpha", 0, 0, (BYTE*)&KeepAlpha, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		KeepAlpha = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "BitStats", 0, 0, (BYTE*)&BitStats, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		BitStats = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "Trace", 0, 0, (BYTE*)&Trace, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		Trace = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "StaticKeyFrames", 0, 0, (BYTE*)&StaticKeyFrames, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		StaticKeyFrames = 0;
+	}
+
+	BufLen=sizeof(DWORD);
+	lRes = RegQueryValueEx(hkSub, "BitstreamV6", 0, 0, (BYTE*)&BitstreamV6, &BufLen);
+	if (lRes != ERROR_SUCCESS)	{
+		BitstreamV6 = 0;
+	}
+
 	BufLen = sizeof(email);
 	lRes = RegQueryValueEx(hkSub, "email", 0, 0, (BYTE*)email, &BufLen);
 	BufLen = sizeof(regcode);
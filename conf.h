@@ -16,9 +16,19 @@ public:
 	BOOL ForceInterval;
 	DWORD loss; //in bits
 	BOOL ForceLoss;
+	DWORD TileSize; //0 - no tiles, otherwise side of tiles in pixels
+	DWORD Preset; //encoder speed, SC_PRESET_*
+	DWORD Threads; //0 - one per CPU
+	DWORD MaxBitrate; //in kbit/s, 0 - no limit; loss is raised above the configured one to stay under it
+	DWORD AdaptiveLoss; //1 - loss only in photo-like blocks, text and UI stay lossless
+	DWORD KeepAlpha; //1 - compress alpha channel of RGB32 input
+	DWORD BitStats; //1 - append bits spent per kind of data and context memory to %TEMP%\scpr_bitstats.txt after compression
+	DWORD Trace; //1 - write timeline of pipeline stages to %TEMP%\scpr_trace_<pid>.json after compression or decompression
+	DWORD StaticKeyFrames; //1 - key frames in independent bands with static models, coded in parallel
+	DWORD BitstreamV6; //1 - write bitstream v6, otherwise v4/v5 readable by older versions of the codec
 
 	Configuration() : KeyFrameInterval(default_interval), hkSub(0), hkSoft(0), 
-		ForceInterval(TRUE), loss(0), ForceLoss(TRUE)
+		ForceInterval(TRUE), loss(0), ForceLoss(TRUE), TileSize(0), Preset(2), Threads(0), MaxBitrate(0), AdaptiveLoss(0), KeepAlpha(0), BitStats(0), Trace(0), StaticKeyFrames(0), BitstreamV6(0)
 	{
 		memset(email, 0, sizeof(email));
 		memset(regcode, 0, sizeof(regcode));
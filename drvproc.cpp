@@ -138,6 +138,9 @@ LRESULT PASCAL DriverProc(DWORD_PTR dwDriverID, HDRVR hDriver, UINT uiMessage, L
     case ICM_COMPRESS_END:
       return pi->CompressEnd();
 
+    case ICM_COMPRESS_FRAMES_INFO:
+      return pi->CompressFramesInfo((ICCOMPRESSFRAMES*)lParam1);
+
     /*********************************************************************
 
       decompress messages
@@ -0,0 +1,149 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// Implementation of CGopEncoder: offline encoding of independent key frame intervals in parallel.
+
+#include "gopenc.h"
+
+#define CMD_GOP_ENCODE 1
+
+CGopEncoder::CGopEncoder(CodecParameters *pParams, int kf_interval, int threads, size_t mem_budget)
+: kfInterval(max(kf_interval, 1)), memBudget(mem_budget), source(NULL), sink(NULL),
+  nFrames(0), nGops(0), nextGop(0), nextOut(0), waitingBytes(0), failed(false), trackUsage(false)
+{
+	memcpy(&params, pParams, sizeof(CodecParameters));
+	if (params.threads == 0) //GOPs already keep all cores busy
+		params.threads = 1;
+	nThreads = threads;
+	if (nThreads <= 0) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		nThreads = info.dwNumberOfProcessors;
+	}
+	const uint X = params.width, Y = params.height;
+	if (params.yuv)
+		frameSize = params.yuv==SC_YUV_444P ? X*Y*3 : X*Y*3/2;
+	else
+		frameSize = ((X * params.bits_per_pixel / 8 + 3) & (~3)) * Y;
+	InitializeCriticalSection(&cs);
+	ev_flushed = CreateEvent(NULL, FALSE/*auto*/, FALSE, NULL);
+}
+
+CGopEncoder::~CGopEncoder()
+{
+	CloseHandle(ev_flushed);
+	DeleteCriticalSection(&cs);
+}
+
+bool CGopEncoder::Run(IFrameSource *src, IFrameSink *dst)
+{
+	source = src; sink = dst;
+	nFrames = src->NumFrames();
+	nGops = (nFrames + kfInterval - 1) / kfInterval;
+	gops.clear();
+	gops.resize(nGops);
+	nextGop = nextOut = 0; waitingBytes = 0; failed = false;
+	usage.Clear();
+
+	const int nw = min(nThreads, max(nGops, 1));
+	readers.assign(nw, NULL);
+	for(int i=0; i<nw; i++) {
+		readers[i] = src->OpenReader();
+		if (!readers[i]) failed = true;
+	}
+	if (!failed) {
+		CSquad squad(nw, 1024*1024); //whole codec runs in each worker, give it a usual thread stack
+		squad.RunParallel(CMD_GOP_ENCODE, NULL, this);
+	}
+	for(int i=0; i<nw; i++)
+		delete readers[i];
+	readers.clear();
+	return !failed && nextOut == nGops;
+}
+
+//each worker takes GOPs one by one until there are none left
+void CGopEncoder::RunCommand(int command, void *params, CSquadWorker *sqworker)
+{
+	if (command != CMD_GOP_ENCODE) return;
+	IFrameReader *reader = readers[sqworker->MyNum()];
+	ScreenCodec sc;
+	std::vector<BYTE> raw(frameSize), outbuf(this->params.width * this->params.height * 6 + 1024);
+	for(;;) {
+		EnterCriticalSection(&cs);
+		//too much data waiting: let the GOP the sink needs next finish first
+		while (!failed && nextGop < nGops && nextGop != nextOut && waitingBytes > memBudget) {
+			LeaveCriticalSection(&cs);
+			WaitForSingleObject(ev_flushed, 50);
+			EnterCriticalSection(&cs);
+		}
+		if (failed || nextGop >= nGops) {
+			LeaveCriticalSection(&cs);
+			break;
+		}
+		const int g = nextGop++;
+		LeaveCriticalSection(&cs);
+
+		EncodeGop(g, reader, sc, raw, outbuf);
+
+		EnterCriticalSection(&cs);
+		gops[g].done = true;
+		waitingBytes += gops[g].data.size();
+		Flush();
+		LeaveCriticalSection(&cs);
+		SetEvent(ev_flushed);
+	}
+}
+
+//fresh codec state for every GOP, so the stream doesn't depend on how GOPs were spread among workers
+void CGopEncoder::EncodeGop(int g, IFrameReader *reader, ScreenCodec &sc, std::vector<BYTE> &raw, std::vector<BYTE> &outbuf)
+{
+	Gop &gop = gops[g];
+	const int first = g * kfInterval, last = min(first + kfInterval, nFrames);
+	CTraceScope ts("GOP", g);
+	sc.Init(&params);
+	sc.TrackContextUsage(trackUsage);
+	for(int n=first; n<last; n++) {
+		CTraceScope tsRead("read frame", n);
+		const bool ok = !failed && reader->GetFrame(n, &raw[0]);
+		tsRead.End();
+		if (!ok) {
+			EnterCriticalSection(&cs);
+			failed = true;
+			LeaveCriticalSection(&cs);
+			break;
+		}
+
+		int ftype = n==first ? 0 : 1;
+		const int sz = sc.CompressFrame(&raw[0], &outbuf[0], outbuf.size(), ftype, params.loss);
+		gop.data.insert(gop.data.end(), outbuf.begin(), outbuf.begin() + sz);
+		gop.sizes.push_back(sz);
+		gop.keys.push_back(ftype==0);
+	}
+	if (trackUsage) {
+		EnterCriticalSection(&cs);
+		usage.Accumulate(sc.GetContextUsageSummary());
+		LeaveCriticalSection(&cs);
+	}
+	sc.Deinit();
+}
+
+void CGopEncoder::Flush()
+{
+	while (!failed && nextOut < nGops && gops[nextOut].done) {
+		Gop &gop = gops[nextOut];
+		const int first = nextOut * kfInterval;
+		CTraceScope ts("write GOP", nextOut);
+		size_t pos = 0;
+		for(size_t i=0; i<gop.sizes.size(); i++) {
+			if (!sink->PutFrame(first + i, &gop.data[pos], gop.sizes[i], gop.keys[i]!=0)) {
+				failed = true;
+				break;
+			}
+			pos += gop.sizes[i];
+		}
+		waitingBytes -= gop.data.size();
+		std::vector<BYTE>().swap(gop.data);
+		nextOut++;
+	}
+}
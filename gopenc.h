@@ -0,0 +1,82 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+#ifndef _GOPENC_H_
+#define _GOPENC_H_
+
+/*
+Offline encoding of a whole clip with several key frame intervals (GOPs)
+compressed at once. Every GOP starts with an I-frame and depends on nothing
+before it, so each squad worker takes the next GOP, encodes it with its own
+ScreenCodec and the results are handed to the sink in frame order.
+Each worker reads its GOP in order through a frame reader of its own, so
+reading doesn't serialize workers and a decoding source doesn't seek back.
+Memory: one raw frame per worker plus compressed GOPs waiting for their turn,
+a worker doesn't start a new GOP while waiting data exceeds the budget.
+*/
+
+#include "screencap.h"
+#include "squad.h"
+
+//raw frames for one worker: frame numbers of one GOP go in order, then it jumps to its next GOP
+class IFrameReader {
+public:
+	virtual ~IFrameReader() {}
+	virtual bool GetFrame(int n, BYTE *pDst)=0; //false on read error
+};
+
+//where raw frames come from
+class IFrameSource {
+public:
+	virtual int NumFrames()=0;
+	virtual IFrameReader* OpenReader()=0; //called from Run for each worker before encoding, NULL on error
+};
+
+//where compressed frames go, called under a lock strictly in frame order
+class IFrameSink {
+public:
+	virtual bool PutFrame(int n, const BYTE *pData, int size, bool keyframe)=0; //false on write error
+};
+
+class CGopEncoder : public ISquadJob {
+	struct Gop {
+		std::vector<BYTE> data; //compressed frames one after another
+		std::vector<int> sizes;
+		std::vector<char> keys;
+		bool done;
+		Gop() : done(false) {}
+	};
+
+	CodecParameters params;
+	int kfInterval, nThreads;
+	size_t memBudget;
+	uint frameSize; //raw frame size in bytes
+
+	IFrameSource *source;
+	IFrameSink *sink;
+	int nFrames, nGops;
+	int nextGop; //next GOP to start
+	int nextOut; //next GOP to give to sink
+	size_t waitingBytes; //compressed data not yet given to sink
+	bool failed;
+	std::vector<Gop> gops;
+	std::vector<IFrameReader*> readers; //one for each worker
+	bool trackUsage;
+	ContextUsage usage; //largest codec instance and counters of all frames
+	CRITICAL_SECTION cs;
+	HANDLE ev_flushed;
+
+	void EncodeGop(int g, IFrameReader *reader, ScreenCodec &sc, std::vector<BYTE> &raw, std::vector<BYTE> &outbuf);
+	void Flush(); //give finished GOPs to sink, must be called under lock
+
+public:
+	CGopEncoder(CodecParameters *pParams, int kf_interval, int threads, size_t mem_budget); //threads: GOPs encoded at once, 0 = one per CPU
+	~CGopEncoder();
+	bool Run(IFrameSource *src, IFrameSink *dst); //false if source or sink failed
+	void TrackContextUsage(bool on) { trackUsage = on; } //before Run
+	const ContextUsage& GetContextUsage() const { return usage; } //after Run: peak memory of one codec instance
+	virtual void RunCommand(int command, void *params, CSquadWorker *sqworker);
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <Windows.h>
 #include "rans_byte.h"
 #include "ans_contexts.h"
+#include "trace.h"
 
 /*
 RansMTCoder class manages a worker thread that's used to encode blocks of data
@@ -23,33 +24,40 @@ them. Then this block of intervals can be encoded independently and in parallel
 to producing and accumulating next block, this is a pipeline.
 
 This parallel processing is used when there is a lot of data in one frame, 
-more than one block. Block size is currently 128k intervals. If it's a simple
+more than one block, the worker thread is created when the first block gets filled.
+Block size is currently 128k intervals. If it's a simple
 frame with not a lot of data (less than one 128k block) it is easier and cheaper 
 to compress them in the same thread, there is no more work in current frame to
 do in parallel to this entropy compression.
+
+Bytes stored without compression (colors from contexts without useful stats)
+go into rANS output among the intervals, as intervals with freq=0. In v6 they
+are kept apart instead: each block is its rANS data size (4 bytes), rANS data
+and then all raw bytes of the block, so rANS loop has no branch and decoder
+reads raw bytes from a pointer of their own.
 */
 struct RansMTCoder {
 	//two buffers: we write to one in main thread and compress the other in another thread
 	std::vector<Freq> ranges[2]; 
+	std::vector<BYTE> raw[2]; //bytes without compression, when rawApart
 	int writingTo; // 0 or 1
 	HANDLE haveJob, ready, done;
+	HANDLE thread; //worker, created when first block gets filled, NULL until then
 	bool quit;
 	BYTE *dst; //where rans writes to
 	static const int B = 128*1024; 
 	CRITICAL_SECTION critsec;
 	RansState ransInitState; //uint32_t, must be RANS_BYTE_L (1<<23)
+	int scaleBits; //intervals are out of 1<<scaleBits: PROB_BITS, PROB_BITS_FX in v6
+	bool rawApart; //raw bytes follow rANS data of each block (v6), otherwise they are intervals with freq=0
 
-	RansMTCoder() {
-		ranges[0].reserve(B);
-		ranges[1].reserve(B);
+	RansMTCoder() : thread(NULL), scaleBits(PROB_BITS), rawApart(false) {
+		//ranges grow with use up to B, so coders of small tiles don't hold 2*B intervals
 		writingTo = 0; quit = false; 
 		haveJob = CreateEvent(NULL, FALSE, FALSE, NULL); //auto reset, initial=false
 		ready = CreateEvent(NULL, FALSE, FALSE, NULL); //initial=false
 		done = CreateEvent(NULL, FALSE, FALSE, NULL); //auto reset, initial=false
 		InitializeCriticalSection(&critsec);
-
-		DWORD tid=0;		
-		CreateThread(NULL, 512*1024, RansWorkerThread, this, 0, &tid);
 	}
 
 	static DWORD WINAPI RansWorkerThread(void* lpParameter) {
@@ -58,6 +66,7 @@ struct RansMTCoder {
 	}
 
 	~RansMTCoder() {
+		stop();
 		CloseHandle(haveJob); CloseHandle(ready); CloseHandle(done);
 		DeleteCriticalSection(&critsec);
 	}
@@ -67,6 +76,7 @@ struct RansMTCoder {
 		dst = pDst;
 		quit = false;
 		ranges[0].resize(0); ranges[1].resize(0);
+		raw[0].resize(0); raw[1].resize(0);
 		ResetEvent(ready); ResetEvent(haveJob); ResetEvent(done);
 	}
 
@@ -75,21 +85,31 @@ struct RansMTCoder {
 
 		ranges[writingTo].push_back(fr);
 		if (ranges[writingTo].size()==B) { //filled the block
+			if (!thread) { //small frames and decoders never need the worker
+				DWORD tid=0;
+				thread = CreateThread(NULL, 512*1024, RansWorkerThread, this, 0, &tid);
+			}
 			SetEvent(haveJob); //tell the worker thread to compress it
+			CTraceScope ts("rANS put wait");
 			WaitForSingleObject(ready, INFINITE); //wait until we're ready to write to another buffer
 		}
 	}
 
+	void putRaw(BYTE c) { //called from main thread when rawApart, goes to the block of next interval
+		raw[writingTo].push_back(c);
+	}
+
 	BYTE* finish() { //data ended, compress what's left in ranges
+		CTraceScope ts("rANS finish");
 		EnterCriticalSection(&critsec); //make sure worker ended its current work piece
-		if (ranges[writingTo].size() > 0) {
-			dst = writeBlock(&ranges[writingTo][0], ranges[writingTo].size(), dst); 
-		}
+		if (ranges[writingTo].size() > 0 || raw[writingTo].size() > 0)
+			dst = writeBlock(ranges[writingTo], raw[writingTo], dst); 
 		LeaveCriticalSection(&critsec);
 		return dst;
 	}
 
 	void threadProc() {//stack size must be more than B*2 i.e. Stack > 256k for B=128k
+		TraceThreadName("rANS");
 		while(!quit) {
 			DWORD res = WaitForSingleObject(haveJob, INFINITE);
 			if (res==WAIT_OBJECT_0) {
@@ -98,22 +118,33 @@ struct RansMTCoder {
 				int idx = writingTo;
 				writingTo ^= 1;
 				ranges[writingTo].resize(0);
+				raw[writingTo].resize(0);
 				EnterCriticalSection(&critsec);
 				SetEvent(ready); //ranges[writingTo] is ready to accept new data
-				dst = writeBlock(&ranges[idx][0], ranges[idx].size(), dst); //meanwhile we're compressing previously filled buffer
+				dst = writeBlock(ranges[idx], raw[idx], dst); //meanwhile we're compressing previously filled buffer
 				LeaveCriticalSection(&critsec);
 			}
 		}
 		SetEvent(done);
 	}
 
+	size_t heapBytes() const { //interval and raw byte buffers
+		return (ranges[0].capacity() + ranges[1].capacity()) * sizeof(Freq) + raw[0].capacity() + raw[1].capacity();
+	}
+
 	void stop() {
+		if (!thread) return;
 		quit = true;
 		SetEvent(haveJob);
 		WaitForSingleObject(done, INFINITE);
+		CloseHandle(thread);
+		thread = NULL;
 	}
 
-	BYTE* writeBlock(Freq *ranges, int len, BYTE *dst) {
+	BYTE* writeBlock(const std::vector<Freq> &block, const std::vector<BYTE> &rawBytes, BYTE *dst) {
+		const Freq *ranges = block.empty() ? NULL : &block[0];
+		const int len = block.size();
+		CTraceScope ts("rANS block", len);
 		RansState rans;
 		//RansEncInit(&rans);
 		rans = ransInitState;
@@ -121,16 +152,29 @@ struct RansMTCoder {
 		BYTE *ptr = tmpbuf + B*2 - 4;
 		BYTE *ptr0 = ptr;
 
-		for(int i=len-1; i>=0; i--) { //rANS encodes in reverse order
-			if (ranges[i].freq) //encode an interval
-				RansEncPut(&rans, &ptr, ranges[i].cumFreq, ranges[i].freq, PROB_BITS);
-			else
-				*--ptr = ranges[i].cumFreq; //store a symbol without compression
-		}
+		if (rawApart) {
+			for(int i=len-1; i>=0; i--) //rANS encodes in reverse order
+				RansEncPut(&rans, &ptr, ranges[i].cumFreq, ranges[i].freq, scaleBits);
+		} else
+			for(int i=len-1; i>=0; i--) { //rANS encodes in reverse order
+				if (ranges[i].freq) //encode an interval
+					RansEncPut(&rans, &ptr, ranges[i].cumFreq, ranges[i].freq, scaleBits);
+				else
+					*--ptr = ranges[i].cumFreq; //store a symbol without compression
+			}
 		RansEncFlush(&rans, &ptr);
 		size_t sz = ptr0 - ptr;
+		if (rawApart) {
+			*(uint*)dst = sz;
+			dst += 4;
+		}
 		memcpy(dst, ptr, sz);
-		return dst + sz;
+		dst += sz;
+		if (rawApart && rawBytes.size()) {
+			memcpy(dst, &rawBytes[0], rawBytes.size());
+			dst += rawBytes.size();
+		}
+		return dst;
 	}
 };//RansMTCoder
 
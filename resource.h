@@ -27,6 +27,7 @@
 #define IDC_LOSS_SLIDER                 1019
 #define IDC_LOSS_TEXT                   1020
 #define IDC_LOSSBYHOST                  1021
+#define IDC_PRESET                      1022
 
 // Next default values for new objects
 // 
@@ -35,7 +36,7 @@
 #define _APS_NO_MFC                     1
 #define _APS_NEXT_RESOURCE_VALUE        106
 #define _APS_NEXT_COMMAND_VALUE         40001
-#define _APS_NEXT_CONTROL_VALUE         1022
+#define _APS_NEXT_CONTROL_VALUE         1023
 #define _APS_NEXT_SYMED_VALUE           101
 #endif
 #endif
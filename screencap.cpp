@@ -24,10 +24,19 @@
 #define CMD_CMPPREV 2
 #define CMD_DOLOSS 3
 #define CMD_CLASSIFYPIXELSI 4
+#define CMD_TILES_COMPRESS 5
+#define CMD_TILES_DECOMPRESS 6
+#define CMD_CLASSIFYBANDS 7
+#define CMD_CODEBANDS 8
+#define CMD_DECODEBANDS 9
+
+//their names on trace timeline
+static const char* cmdNames[] = { "", "block types", "compare prev", "loss", "classify pixels I", "tiles compress", "tiles decompress",
+	"classify bands I", "code bands I", "decode bands I" };
 
 template<class RC>
 CScreenCapt<RC>::CScreenCapt(int ver) 
-: init(false), loss_mask(0), msr_x(256), msr_y(256), msrlow_x(8), msrlow_y(8), pSquad(NULL), last_was_flat(false), myVersion(ver)
+: init(false), loss_mask(0), msr_x(256), msr_y(256), msrlow_x(8), msrlow_y(8), srch_x(256), srch_y(256), pSquad(NULL), nThreads(0), adaptiveLoss(false), last_was_flat(false), last_ftype(0), last_was_static(false), allowSceneCut(false), scratchBytes(0), peakScratchBytes(0), countUsage(false), myVersion(ver), staticI(false)
 #ifndef NOPROTECT
   ,vm(102400,102400)
 #endif
@@ -76,16 +85,25 @@ void CScreenCapt<RC>::Init(CodecParameters *pParams)
 	if (myVersion < 3) {
 		msr_x = pParams->high_range_x; msr_y = pParams->high_range_y;
 	} else {
-		msr_x = min(pParams->high_range_x, 256); msr_y = min(pParams->high_range_y, 256); // in v3 this is fixed for now
+		msr_x = 256; msr_y = 256; // in v3 this is fixed for now
+	}
+	mvmax_x = msr_x; mvmax_y = msr_y;
+	if (myVersion >= 5) { //longer vectors are escaped
+		mvmax_x = min(X, 32767); mvmax_y = min(Y, 32767);
 	}
-	msrlow_x = pParams->low_range_x; msrlow_y = pParams->low_range_y;
+	srch_x = min(pParams->high_range_x, mvmax_x); srch_y = min(pParams->high_range_y, mvmax_y);
+	msrlow_x = min(pParams->low_range_x, msr_x); msrlow_y = min(pParams->low_range_y, msr_y);
 	ec.setMotionRange(msr_x, msr_y);
+	nThreads = pParams->threads;
+	adaptiveLoss = pParams->adaptive_loss > 0;
+	staticI = pParams->static_iframes > 0 && myVersion >= 6;
 	#ifdef TIMING
 	QueryPerformanceFrequency(&perfreq);
 	#endif
 
 	nbx = (X+15)/16;
 	nby = (Y+15)/16;
+	xxBytes = (myVersion >= 5 && nbx*nby > 65536) ? 3 : 2;
 	prev = (BYTE*)calloc(Y,stride);
 	bts = (BYTE*)calloc(nbx,nby);
 	for(uint i=0;i<3;i++)
@@ -117,7 +135,7 @@ void CScreenCapt<RC>::Init(CodecParameters *pParams)
 	vm.Run(&code[0], code.size(), &data, "vm.log");
 #endif
 	SetupLossMask(pParams->loss);
-	rleData.resize(Y*X*5);
+	scratchBytes = peakScratchBytes = 0;
 	
 	last_was_flat = false;
 	init = true;
@@ -170,6 +188,7 @@ void CScreenCapt<RC>::Deinit()
 	    delete pSquad;
 	    pSquad = NULL;
 	}
+	std::vector<StaticRansCtx>().swap(stabs);
 	init = false;
 }
 
@@ -199,6 +218,7 @@ void CScreenCapt<RC>::RenewI()
 
 template<class RC>
 void CScreenCapt<RC>::DoLoss(BYTE *pSrc, PrevCmpParams* pcparams) {
+	CTraceScope ts("DoLoss");
 	if (loss_mask != -1)
 		pSquad->RunParallel(CMD_DOLOSS, pcparams, this);
 
@@ -219,6 +239,44 @@ void CScreenCapt<RC>::DoLoss(BYTE *pSrc, PrevCmpParams* pcparams) {
 	}
 }
 
+//natural image (photo, video) has few pixels repeating their neighbours,
+//text and UI have lots of them. Only pixels inside the block are used,
+//so blocks can be classified and changed in parallel.
+template<class RC>
+bool CScreenCapt<RC>::IsNaturalBlock(BYTE *pSrc, int x1, int y1, int x2, int y2)
+{
+	const int off = -stride-3;
+	int n = 0, total = (x2-x1-1) * (y2-y1-1);
+	if (total <= 0) return false;
+	for(int y=y1+1; y<y2; y++) {
+		int i = y*stride + (x1+1)*3;
+		for(int x=x1+1; x<x2; x++, i+=3) {
+			const int r=pSrc[i], g=pSrc[i+1], b=pSrc[i+2];
+			if (r==pSrc[i-3] && g==pSrc[i-2] && b==pSrc[i-1]) continue;
+			if (r==pSrc[i+off+3] && g==pSrc[i+off+4] && b==pSrc[i+off+5]) continue;
+			if (r==pSrc[i+off] && g==pSrc[i+off+1] && b==pSrc[i+off+2]) continue;
+			n++;
+		}
+	}
+	return n * 4 >= total * 3;
+}
+
+template<class RC>
+void CScreenCapt<RC>::LossBlockRow(BYTE *pSrc, int by)
+{
+	const BYTE lmask = loss_mask & 255, cmask = corr_mask & 255;
+	const int y1 = by*16, y2 = min(by*16+16, Y);
+	for(int bx=0; bx<nbx; bx++) {
+		const int x1 = bx*16, x2 = min(bx*16+16, X);
+		if (!IsNaturalBlock(pSrc, x1, y1, x2, y2)) continue;
+		for(int y=y1; y<y2; y++) {
+			BYTE *p = &pSrc[y*stride + x1*3];
+			for(int i=0; i<(x2-x1)*3; i++)
+				p[i] = (p[i] & lmask) | cmask;
+		}
+	}
+}
+
 extern HMODULE hmoduleSCPR;
 
 #ifndef NOPROTECT
@@ -331,7 +389,8 @@ int CScreenCapt<RC>::CompressI(BYTE *pSrc, BYTE *pDST)
 	DoLoss(pSrc, &prevcmp); //do loss, if necessary
 	cx = cx1 = 0;
 
-	pSquad->RunParallel(CMD_CLASSIFYPIXELSI, pSrc, this); //fills tls[] and rleData[]
+	pSquad->RunParallel(CMD_CLASSIFYPIXELSI, pSrc, this); //fills tls[].runs
+	CountScratch(nThreads);
 	#ifdef TIMING
 	QueryPerformanceCounter(&t1);
 	auto classifyTime = t1.QuadPart - t0.QuadPart;
@@ -339,6 +398,7 @@ int CScreenCapt<RC>::CompressI(BYTE *pSrc, BYTE *pDST)
 	for(int i=0;i<runCmdTimes.size();i++) printf("%lf ", runCmdTimes[i]);
 	printf("} ");
 	#endif
+	CTraceScope tsEncode("encode I");
 	ec.encodeBegin(pDst);
 	RenewI(); //this can be done while waiting for CMD_CLASSIFYPIXELSI
 	EncodeRGB(pSrc);
@@ -363,22 +423,20 @@ int CScreenCapt<RC>::CompressI(BYTE *pSrc, BYTE *pDST)
 	int x = 0, y = 1; //lasti = y*stride + x*3
 
 	for(int band=0; band < nThreads; band++) {
-		const int jend = tls[band].rleStartPos + tls[band].rleSize;
-		int j = tls[band].rleStartPos;
+		const int jend = tls[band].runs.size();
+		const BYTE *runs = jend > 0 ? &tls[band].runs[0] : NULL;
+		int j = 0;
 		while(j < jend) {
-			ptype = rleData[j];
+			GetRun(runs, j, ptype, n);
 
 			cx1 = ((pSrc[lasti+1]>>SC_CXSHIFT)<<6)&0xFC0;
 			cx = pSrc[lasti+2]>>SC_CXSHIFT;
 
 			CheckDstLength(&ec.pDst, &pDST);
-			WritePixel(ptype, lastptype, &rleData[j+1]);
+			i = x+1 < X ? y * stride + (x+1)*3 : (y+1) * stride; //first pixel of the run
+			WritePixel(ptype, lastptype, &pSrc[i]);
 			lastptype = ptype;
-			if (!ptype) 
-				j += 3;
-			n = rleData[j+1];
 			ec.encodeN(n, ntab[ptype]);
-			j += 2;
 			x += n;
 			while(x >= X) {
 				x -= X; y++;
@@ -388,10 +446,12 @@ int CScreenCapt<RC>::CompressI(BYTE *pSrc, BYTE *pDST)
 	}
 
 	pDst = ec.encodeEnd();
+	tsEncode.End();
 	#ifdef TIMING
 	QueryPerformanceCounter(&t0);
 	auto encodeTime = t0.QuadPart - t1.QuadPart;
 	#endif
+	CTraceScope tsCopy("memcpy prev");
 	memcpy(prev, pSrc, Y*stride);
 	if (saveBuffer.size() > 0)
 		saveBuffer.resize(pDst - pDST);
@@ -409,11 +469,56 @@ int CScreenCapt<RC>::CompressI(BYTE *pSrc, BYTE *pDST)
 		i = y*stride + x*3; \
 	}
 
+//fill n pixels of I-frame from (x,y) on by their type, r,g,b is the color of type 0
+template<class RC>
+void CScreenCapt<RC>::PutRun(BYTE *pDst, int ptype, int n, int r, int g, int b, int &x, int &y, int &lasti)
+{
+	const int off = -stride-3;
+	int i = y*stride + x*3;
+	switch(ptype) {
+	case 0:
+		while(n-->0) {
+			pDst[i] = r;
+			pDst[i+1] = g;
+			pDst[i+2] = b;
+			GO_NEXT_PIXEL;
+		}
+		break;
+	case 1:
+		while(n-->0) {
+			pDst[i] = pDst[lasti]; pDst[i+1] = pDst[lasti+1]; pDst[i+2] = pDst[lasti+2];
+			GO_NEXT_PIXEL;
+		}
+		break;
+	case 2:
+		while(n-->0) {
+			pDst[i] = pDst[i+off+3]; pDst[i+1] = pDst[i+off+4]; pDst[i+2] = pDst[i+off+5];
+			GO_NEXT_PIXEL;
+		}
+		break;
+	case 4:
+		while(n-->0) {
+			pDst[i] = (int)pDst[lasti] + (int)pDst[i+off+3] - (int)pDst[i+off];
+			pDst[i+1] = (int)pDst[lasti+1] + (int)pDst[i+off+4] - (int)pDst[i+off+1];
+			pDst[i+2] = (int)pDst[lasti+2] + (int)pDst[i+off+5] - (int)pDst[i+off+2];
+			GO_NEXT_PIXEL;
+		}
+		break;
+	case 5:
+		while(n-->0) {
+			pDst[i] = pDst[i+off]; pDst[i+1] = pDst[i+off+1]; pDst[i+2] = pDst[i+off+2];
+			GO_NEXT_PIXEL;
+	    }
+		break;
+	}
+}
+
 //decompress RGB24 I-frame
 template<class RC>
 int CScreenCapt<RC>::DecompressI(BYTE *pSrc, int srcLength, BYTE *pDst)
 {
 	int r,g,b;
+	CTraceScope ts("decode I");
 	ec.decodeBegin(pSrc, srcLength);
 	RenewI();
 	cx = cx1 = 0;
@@ -437,8 +542,6 @@ int CScreenCapt<RC>::DecompressI(BYTE *pSrc, int srcLength, BYTE *pDst)
 		}		
 	}
 
-	const int off = -stride-3;
-
 	int x = (i % stride)/3, y = i / stride;
 	while(y<Y) {
 		lastptype = ptype;
@@ -448,43 +551,7 @@ int CScreenCapt<RC>::DecompressI(BYTE *pSrc, int srcLength, BYTE *pDst)
 			DecodeRGB(r,g,b);	
 		n = ec.decodeN(ntab[ptype]);
 		lprintf(logF, "n=%d\n",n);
-		i = y*stride + x*3;
-		switch(ptype) {
-		case 0:
-			while(n-->0) {
-				pDst[i] = r;
-				pDst[i+1] = g;
-				pDst[i+2] = b;
-				GO_NEXT_PIXEL;
-			}
-			break;
-		case 1:
-			while(n-->0) {
-				pDst[i] = pDst[lasti]; pDst[i+1] = pDst[lasti+1]; pDst[i+2] = pDst[lasti+2];
-				GO_NEXT_PIXEL;
-			}
-			break;
-		case 2:
-			while(n-->0) {
-				pDst[i] = pDst[i+off+3]; pDst[i+1] = pDst[i+off+4]; pDst[i+2] = pDst[i+off+5];
-				GO_NEXT_PIXEL;
-			}
-			break;
-		case 4:
-			while(n-->0) {
-				pDst[i] = (int)pDst[lasti] + (int)pDst[i+off+3] - (int)pDst[i+off];
-				pDst[i+1] = (int)pDst[lasti+1] + (int)pDst[i+off+4] - (int)pDst[i+off+1];
-				pDst[i+2] = (int)pDst[lasti+2] + (int)pDst[i+off+5] - (int)pDst[i+off+2];
-				GO_NEXT_PIXEL;
-			}
-			break;
-		case 5:
-			while(n-->0) {
-				pDst[i] = pDst[i+off]; pDst[i+1] = pDst[i+off+1]; pDst[i+2] = pDst[i+off+2];
-				GO_NEXT_PIXEL;
-		    }
-			break;
-		}
+		PutRun(pDst, ptype, n, r, g, b, x, y, lasti);
 		g = pDst[lasti+1];
 		b = pDst[lasti+2];
 
@@ -497,6 +564,270 @@ int CScreenCapt<RC>::DecompressI(BYTE *pSrc, int srcLength, BYTE *pDst)
 	return 1;
 }
 
+//Pixel types in the first rows of SC_STATIC_I band can't refer to rows above the band:
+//first row has only 0 and 1 (left), second row adds 2, and 4, 5 from its second pixel on.
+static inline bool BandTypeAllowed(int ptype, int x, int dy) //dy: row inside the band
+{
+	switch(ptype) {
+	case 1: return x > 0 || dy > 0;
+	case 2: return dy > 0;
+	case 4: case 5: return dy > 1 || (dy==1 && x > 0);
+	}
+	return true;
+}
+
+//GetPixelType for first two rows of a band, same order of preference
+template<class RC>
+int CScreenCapt<RC>::GetPixelTypeBand(int x, int dy, BYTE* pSrc, BYTE* pSrclast, const int off)
+{
+	static const int types[] = { 1, 5, 2, 4 };
+	for(int k=0; k<4; k++)
+		if (BandTypeAllowed(types[k], x, dy) && PixelTypeFits(types[k], pSrc, pSrclast, off))
+			return types[k];
+	return 0;
+}
+
+template<class RC>
+bool CScreenCapt<RC>::PixelTypeFitsBand(int ptype, int x, int dy, BYTE *pSrc, BYTE* pSrclast, const int off)
+{
+	return BandTypeAllowed(ptype, x, dy) && PixelTypeFits(ptype, pSrc, pSrclast, off);
+}
+
+//compress an RGB24 I-frame as SC_STATIC_I: [2 bytes: bands][SC_STABS models]
+//[rows and size of each band, 4 bytes each][coded bands]. Each worker classifies its band
+//of rows and counts symbols there, models are made from the counts of all bands,
+//then the workers code their bands with them in parallel. Nothing in a band refers
+//to other bands, so decoder can work on them in parallel too.
+//P-frames after it start from renewed adaptive stats.
+//Static models are not adaptive contexts, such frames add nothing to BitStats and ContextUsage.
+template<class RC>
+int CScreenCapt<RC>::CompressIStatic(BYTE *pSrc, BYTE *pDST)
+{
+	BYTE *pDst = pDST;
+	const int nb = pSquad->NumThreads();
+
+	PrevCmpParams prevcmp(pSrc, nb);
+	DoLoss(pSrc, &prevcmp); //do loss, if necessary
+	pSquad->RunParallel(CMD_CLASSIFYBANDS, pSrc, this); //fills tls[].runs and tls[].counts
+	CountScratch(nb);
+	RenewI();
+
+	CTraceScope tsModels("static models");
+	std::vector<uint> &cnt = tls[0].counts;
+	for(int band=1; band<nb; band++)
+		for(int k=0; k<SC_STABS*256; k++)
+			cnt[k] += tls[band].counts[k];
+	stabs.resize(SC_STABS);
+	std::vector<BYTE> hdr(2 + SC_STABS * (2 + 256*3)); //count, then gap and freq of each symbol
+	BYTE *ph = &hdr[0];
+	*(WORD*)ph = nb; ph += 2;
+	for(int t=0; t<SC_STABS; t++) {
+		const int nsym = t < SC_STAB_N ? 6 : 256;
+		stabs[t].build(&cnt[t*256], nsym);
+		ph = stabs[t].write(ph, nsym);
+	}
+	tsModels.End();
+
+	pSquad->RunParallel(CMD_CODEBANDS, pSrc, this); //fills tls[].coded
+	int csz = (ph - &hdr[0]) + nb*8;
+	for(int band=0; band<nb; band++)
+		csz += tls[band].coded.size();
+	if (pDst + csz > pDstEnd) { //won't fit, CompressFrame returns it from saveBuffer next time
+		saveBuffer.resize(csz);
+		pDst = &saveBuffer[0];
+	}
+	BYTE *pStart = pDst;
+	memcpy(pDst, &hdr[0], ph - &hdr[0]);
+	pDst += ph - &hdr[0];
+	for(int band=0; band<nb; band++) {
+		*(uint*)pDst = tls[band].rows;
+		*(uint*)(pDst+4) = tls[band].coded.size();
+		pDst += 8;
+	}
+	for(int band=0; band<nb; band++)
+		if (tls[band].coded.size()) {
+			memcpy(pDst, &tls[band].coded[0], tls[band].coded.size());
+			pDst += tls[band].coded.size();
+		}
+
+	CTraceScope tsCopy("memcpy prev");
+	memcpy(prev, pSrc, Y*stride);
+	return pDst - pStart;
+}
+
+//runs of SC_STATIC_I band like in ClassifyPixelsI, then symbols of the band are counted
+template<class RC>
+void CScreenCapt<RC>::ClassifyBand(int myNum, int y0, int ysize, BYTE *pSrc)
+{
+	WorkerData &wd = tls[myNum];
+	wd.runs.clear();
+	wd.y0 = y0; wd.rows = ysize;
+
+	const int off = -stride-3;
+	const int yend = y0 + ysize;
+	int x = 0, y = y0, lasti = y0*stride, ptype = 0, n = 0;
+	while(y < yend) {
+		const int i = y * stride + x*3;
+		const int dy = y - y0;
+		if (n > 0 && n < 255 && (dy > 1 ? PixelTypeFits(ptype, &pSrc[i], &pSrc[lasti], off) : PixelTypeFitsBand(ptype, x, dy, &pSrc[i], &pSrc[lasti], off)))
+			n++;
+		else {
+			if (n > 0)
+				wd.AddRun(ptype, n);
+			ptype = dy > 1 ? GetPixelType(&pSrc[i], &pSrc[lasti], off) : GetPixelTypeBand(x, dy, &pSrc[i], &pSrc[lasti], off);
+			n = 1;
+		}
+		lasti = i;
+		x++;
+		if (x>=X) {
+			x = 0; y++;
+		}
+	}
+	if (n > 0)
+		wd.AddRun(ptype, n);
+	CodeBand(wd, pSrc, true);
+}
+
+template<class RC>
+inline void CScreenCapt<RC>::PutBandSymbol(WorkerData &wd, int model, int c, bool counting)
+{
+	if (counting) {
+		wd.counts[model*256 + c]++;
+		return;
+	}
+	Freq fr;
+	stabs[model].encode(c, fr);
+	wd.ranges.push_back(fr);
+	if (wd.ranges.size()==RansMTCoder::B)
+		FlushBand(wd);
+}
+
+//symbols of SC_STATIC_I band from its runs, counted for the models or coded with them
+template<class RC>
+void CScreenCapt<RC>::CodeBand(WorkerData &wd, BYTE *pSrc, bool counting)
+{
+	if (counting)
+		wd.counts.assign(SC_STABS*256, 0);
+	else {
+		wd.ranges.clear();
+		wd.coded.clear();
+	}
+	const int jend = wd.runs.size();
+	const BYTE *runs = jend > 0 ? &wd.runs[0] : NULL;
+	int j = 0, x = 0, y = wd.y0, lastptype = 0, cb = 0; //cb: context of red, blue of previous pixel
+	while(j < jend) {
+		int ptype, n;
+		GetRun(runs, j, ptype, n);
+		PutBandSymbol(wd, lastptype, ptype, counting);
+		if (ptype==0) {
+			const BYTE *p = &pSrc[y*stride + x*3];
+			PutBandSymbol(wd, SC_STAB_C + cb, p[0], counting);
+			PutBandSymbol(wd, SC_STAB_C + SC_SCXMAX + (p[0] >> SC_SCXSHIFT), p[1], counting);
+			PutBandSymbol(wd, SC_STAB_C + 2*SC_SCXMAX + (p[1] >> SC_SCXSHIFT), p[2], counting);
+		}
+		PutBandSymbol(wd, SC_STAB_N + ptype, n, counting);
+		lastptype = ptype;
+		x += n;
+		while(x >= X) {
+			x -= X; y++;
+		}
+		const int lasti = x > 0 ? y*stride + (x-1)*3 : (y-1)*stride + (X-1)*3;
+		cb = pSrc[lasti+2] >> SC_SCXSHIFT;
+	}
+	if (!counting && wd.ranges.size())
+		FlushBand(wd);
+}
+
+//rANS blocks of a band follow each other, decoder starts next one after RansMTCoder::B symbols
+template<class RC>
+void CScreenCapt<RC>::FlushBand(WorkerData &wd)
+{
+	CTraceScope ts("rANS block", wd.ranges.size());
+	const size_t pos = wd.coded.size();
+	wd.coded.resize(pos + wd.ranges.size()*2 + 16); //12 bits at most per symbol
+	BYTE *end = &wd.coded[0] + wd.coded.size(), *ptr = end;
+	RansState rans;
+	RansEncInit(&rans);
+	for(int i=(int)wd.ranges.size()-1; i>=0; i--) //rANS encodes in reverse order
+		RansEncPut(&rans, &ptr, wd.ranges[i].cumFreq, wd.ranges[i].freq, PROB_BITS);
+	RansEncFlush(&rans, &ptr);
+	const size_t sz = end - ptr;
+	memmove(&wd.coded[pos], ptr, sz);
+	wd.coded.resize(pos + sz);
+	wd.ranges.clear();
+}
+
+template<class RC>
+inline int CScreenCapt<RC>::GetBandSymbol(RansState &rans, BYTE *&pSrc, int &nDec, int model)
+{
+	if (nDec==RansMTCoder::B) {
+		RansDecInit(&rans, &pSrc);
+		nDec = 0;
+	}
+	nDec++;
+	Freq fr;
+	const int c = stabs[model].decode(RansDecGet(&rans, PROB_BITS), fr);
+	RansDecAdvance(&rans, &pSrc, fr.cumFreq, fr.freq, PROB_BITS);
+	return c;
+}
+
+template<class RC>
+void CScreenCapt<RC>::DecodeBand(BYTE *pSrc, BYTE *pDst, int y0, int ysize)
+{
+	RansState rans;
+	int nDec = RansMTCoder::B; //first block starts with first symbol
+	int x = 0, y = y0, lasti = y0*stride, lastptype = 0, cb = 0, r = 0, g = 0, b = 0;
+	const int yend = y0 + ysize;
+	while(y < yend) {
+		const int ptype = GetBandSymbol(rans, pSrc, nDec, lastptype);
+		if (ptype==0) {
+			r = GetBandSymbol(rans, pSrc, nDec, SC_STAB_C + cb);
+			g = GetBandSymbol(rans, pSrc, nDec, SC_STAB_C + SC_SCXMAX + (r >> SC_SCXSHIFT));
+			b = GetBandSymbol(rans, pSrc, nDec, SC_STAB_C + 2*SC_SCXMAX + (g >> SC_SCXSHIFT));
+		}
+		const int n = min(GetBandSymbol(rans, pSrc, nDec, SC_STAB_N + ptype), (yend - y) * X - x);
+		if (n < 1 || ptype==3) break; //broken data
+		PutRun(pDst, ptype, n, r, g, b, x, y, lasti);
+		lastptype = ptype;
+		cb = pDst[lasti+2] >> SC_SCXSHIFT;
+	}
+}
+
+template<class RC>
+int CScreenCapt<RC>::DecompressIStatic(BYTE *pSrc, int srcLength, BYTE *pDst)
+{
+	BYTE *p = pSrc, *end = pSrc + srcLength;
+	if (srcLength < 2) return 0;
+	const int nb = *(WORD*)p;
+	p += 2;
+	stabs.resize(SC_STABS);
+	for(int t=0; t<SC_STABS; t++) {
+		p = stabs[t].read(p, end, t < SC_STAB_N ? 6 : 256);
+		if (!p) return 0;
+		stabs[t].makeSlots();
+	}
+	if (end - p < nb*8) return 0;
+	StaticIParams sp;
+	sp.pDst = pDst;
+	sp.data.resize(nb); sp.y0.resize(nb); sp.rows.resize(nb);
+	BYTE *data = p + nb*8;
+	int y0 = 0;
+	for(int band=0; band<nb; band++, p+=8) {
+		const uint rows = *(uint*)p, size = *(uint*)(p+4);
+		if (rows > (uint)(Y - y0) || size > (uint)(end - data)) return 0;
+		sp.data[band] = data; sp.y0[band] = y0; sp.rows[band] = rows;
+		y0 += rows;
+		data += size;
+	}
+	if (y0 != Y) return 0;
+
+	StartSquad();
+	RenewI();
+	pSquad->RunParallel(CMD_DECODEBANDS, &sp, this);
+	memcpy(prev, pDst, Y*stride);
+	return 1;
+}
+
 //can pixel of I-frame be predicted by its neighbours?
 template<class RC>
 int CScreenCapt<RC>::GetPixelType(BYTE* pSrc, BYTE* pSrclast, const int off)
@@ -698,16 +1029,21 @@ bool CScreenCapt<RC>::FindMV(BYTE *pSrc, int bi, int &last_mvx, int &last_mvy, i
 	if ((rx2 + x2-x1) > X) rx2 = X - x2 + x1 +1;
 	if ((ry2 + y2-y1) > Y) ry2 = Y - y2 + y1 +1;
 
-	int fx1 = x1 - msr_x; // far search
-	int fx2 = x1 + msr_x;
-	int fy1 = y1 - msr_y;
-	int fy2 = y1 + msr_y;
+	int fx1 = x1 - mvmax_x; // any vector that can be coded
+	int fx2 = x1 + mvmax_x;
+	int fy1 = y1 - mvmax_y;
+	int fy2 = y1 + mvmax_y;
 
 	if (fx1<0) fx1 = 0;
 	if (fy1<0) fy1 = 0;
 	if ((fx2 + x2-x1) > X) fx2 = X - x2 + x1 +1;
 	if ((fy2 + y2-y1) > Y) fy2 = Y - y2 + y1 +1;
 
+	int sx1 = max(x1 - (int)srch_x, fx1); // far search
+	int sx2 = min(x1 + (int)srch_x, fx2);
+	int sy1 = max(y1 - (int)srch_y, fy1);
+	int sy2 = min(y1 + (int)srch_y, fy2);
+
 	const int is = y1*stride + x1*bytespp;
 	const int width_bytes = (x2-x1)*bytespp;
 	const int height = y2 - y1;
@@ -734,7 +1070,7 @@ bool CScreenCapt<RC>::FindMV(BYTE *pSrc, int bi, int &last_mvx, int &last_mvy, i
 		}
 	}
 
-	const int commonYdist = min(y1 - fy1, fy2 - y1 - 1);
+	const int commonYdist = min(y1 - sy1, sy2 - y1 - 1);
 	//far search
 	int yup = y1-1, ydown = y1+1;
 	for(int k=0;k<commonYdist;k++,yup--,ydown++) {
@@ -750,27 +1086,27 @@ bool CScreenCapt<RC>::FindMV(BYTE *pSrc, int bi, int &last_mvx, int &last_mvy, i
 		}
 	}
 
-	for(;yup>=fy1; yup--)//up
+	for(;yup>=sy1; yup--)//up
 		if (SameBlocks(pSrc, is, yup*stride + x1*bytespp, width_bytes, height))	{
 			last_mvx = mvs[0][bi] = 0;
 			last_mvy = mvs[1][bi] = yup - y1;
 			return true;
 		}
-	for(; ydown<fy2; ydown++)//down
+	for(; ydown<sy2; ydown++)//down
 		if (SameBlocks(pSrc, is, ydown*stride + x1*bytespp, width_bytes, height))	{
 			last_mvx = mvs[0][bi] = 0;
 			last_mvy = mvs[1][bi] = ydown - y1;
 			return true;
 		}
 
-	for(int x=x1; x>=fx1; x--) //far left
+	for(int x=x1; x>=sx1; x--) //far left
 		if (SameBlocks(pSrc, is, y1*stride +x*bytespp, width_bytes, height))	{
 			last_mvx = mvs[0][bi] = x - x1;
 			last_mvy = mvs[1][bi] = 0;
 			return true;
 		}
 
-	for(int x=x1; x<fx2; x++) //far right
+	for(int x=x1; x<sx2; x++) //far right
 		if (SameBlocks(pSrc, is, y1*stride + x*bytespp, width_bytes, height))	{
 			last_mvx = mvs[0][bi] = x - x1;
 			last_mvy = mvs[1][bi] = 0;
@@ -813,6 +1149,48 @@ bool CScreenCapt<RC>::FindMV(BYTE *pSrc, int bi, int &last_mvx, int &last_mvy, i
 	return false;
 }
 
+//motion vector in V3+, in v5 the lowest value is an escape for long vectors
+template<class RC>
+void CScreenCapt<RC>::EncodeMV(int mx, int my)
+{
+	if (myVersion >= 5 && (mx <= -(int)msr_x || mx >= (int)msr_x)) {
+		ec.encodeMX(0, mvtab[0]);
+		EncodeLongMV(mx);
+	} else
+		ec.encodeMX(mx+msr_x, mvtab[0]);
+	if (myVersion >= 5 && (my <= -(int)msr_y || my >= (int)msr_y)) {
+		ec.encodeMY(0, mvtab[1]);
+		EncodeLongMV(my);
+	} else
+		ec.encodeMY(my+msr_y, mvtab[1]);
+}
+
+template<class RC>
+void CScreenCapt<RC>::DecodeMV(int &mx, int &my)
+{
+	mx = ec.decodeMX(mvtab[0]);
+	mx = (myVersion >= 5 && mx==0) ? DecodeLongMV() : mx - msr_x;
+	my = ec.decodeMY(mvtab[1]);
+	my = (myVersion >= 5 && my==0) ? DecodeLongMV() : my - msr_y;
+}
+
+//16 bits, two's complement
+template<class RC>
+void CScreenCapt<RC>::EncodeLongMV(int m)
+{
+	for(int k=15; k>=0; k--)
+		ec.encodeBool(((m >> k) & 1) != 0);
+}
+
+template<class RC>
+int CScreenCapt<RC>::DecodeLongMV()
+{
+	int m = 0;
+	for(int k=0; k<16; k++)
+		m = (m << 1) | (ec.decodeBool() ? 1 : 0);
+	return (short)m;
+}
+
 template<class RC>
 bool CScreenCapt<RC>::SameBlocks(BYTE *pSrc, int is, int ip, int width_bytes, int height)
 {
@@ -829,6 +1207,7 @@ template<class RC>
 void CScreenCapt<RC>::RunCommand(int command, void *params, CSquadWorker *sqworker)
 {
 	const int myNum = sqworker->MyNum();
+	CTraceScope ts(cmdNames[command]);
 
 	#ifdef TIMING
 	LARGE_INTEGER t0, t1;
@@ -851,6 +1230,13 @@ void CScreenCapt<RC>::RunCommand(int command, void *params, CSquadWorker *sqwork
 	} 
 	case CMD_DOLOSS: {
 		PrevCmpParams *prevcmp = (PrevCmpParams*) params;
+		if (adaptiveLoss) {
+			int by1=0, bys=nby;
+			sqworker->GetSegment(nby, by1, bys);
+			for(int by=by1; by<by1+bys; by++)
+				LossBlockRow(prevcmp->pSrc, by);
+			break;
+		}
 		int y1=0, ys=Y;
 		sqworker->GetSegment(Y, y1, ys);
 		int n = ys*stride / 4;
@@ -865,6 +1251,21 @@ void CScreenCapt<RC>::RunCommand(int command, void *params, CSquadWorker *sqwork
 		ClassifyPixelsI(myNum, y0, ysize, (BYTE*)params);
 		break;
 	}
+	case CMD_CLASSIFYBANDS: {
+		int y0=0, ysize=0;
+		sqworker->GetSegment(Y, y0, ysize);
+		ClassifyBand(myNum, y0, ysize, (BYTE*)params);
+		break;
+	}
+	case CMD_CODEBANDS:
+		CodeBand(tls[myNum], (BYTE*)params, false);
+		break;
+	case CMD_DECODEBANDS: { //bands of the encoder, their number may differ from ours
+		StaticIParams *sp = (StaticIParams*)params;
+		for(size_t band=myNum; band<sp->rows.size(); band+=sqworker->NumThreads())
+			DecodeBand(sp->data[band], sp->pDst, sp->y0[band], sp->rows[band]);
+		break;
+	}
 	}//switch
 	#ifdef TIMING
 	QueryPerformanceCounter(&t1);
@@ -875,8 +1276,8 @@ void CScreenCapt<RC>::RunCommand(int command, void *params, CSquadWorker *sqwork
 template<class RC>
 void CScreenCapt<RC>::ClassifyPixelsI(int myNum, int y0, int ysize, BYTE *pSrc)
 {
-	int j = y0 * X * 5;
-	tls[myNum].rleStartPos = j;
+	WorkerData &wd = tls[myNum];
+	wd.runs.clear();
 
 	int x = 0, y = y0, lasti = (y0-1) * stride + (X-1)*3;
 	if (y0==0) {
@@ -887,10 +1288,6 @@ void CScreenCapt<RC>::ClassifyPixelsI(int myNum, int y0, int ysize, BYTE *pSrc)
 	const int off = -stride-3;
 	const int i0 = y * stride + x*3;
 	int ptype = GetPixelType(&pSrc[i0], &pSrc[lasti], off);	
-	rleData[j++] = ptype;
-	if (!ptype) {
-		rleData[j++] = pSrc[i0]; rleData[j++] = pSrc[i0+1]; rleData[j++] = pSrc[i0+2];
-	}
 	int n = 1; 
 	x++; lasti = i0;
 
@@ -899,12 +1296,8 @@ void CScreenCapt<RC>::ClassifyPixelsI(int myNum, int y0, int ysize, BYTE *pSrc)
 		if ((n<255) && PixelTypeFits(ptype, &pSrc[i], &pSrc[lasti], off)) 
 			n++;		
 		else {
-			rleData[j++] = n;
+			wd.AddRun(ptype, n);
 			ptype = GetPixelType(&pSrc[i], &pSrc[lasti], off);
-			rleData[j++] = ptype;
-			if (!ptype) {
-				rleData[j++] = pSrc[i]; rleData[j++] = pSrc[i+1]; rleData[j++] = pSrc[i+2];
-			}
 			n = 1;
 		}	
 		lasti = i;
@@ -913,9 +1306,47 @@ void CScreenCapt<RC>::ClassifyPixelsI(int myNum, int y0, int ysize, BYTE *pSrc)
 			x = 0; y++;
 		}
 	}
-	rleData[j++] = n;
+	wd.AddRun(ptype, n);
+}
 
-	tls[myNum].rleSize = j - tls[myNum].rleStartPos;
+template<class RC>
+void CScreenCapt<RC>::CountScratch(int nbands)
+{
+	scratchBytes = 0;
+	for(int i=0; i<nbands; i++)
+		scratchBytes += tls[i].runs.size();
+	peakScratchBytes = max(peakScratchBytes, scratchBytes);
+	lprintf(logF, "scratch bytes=%u peak=%u\n", scratchBytes, peakScratchBytes);
+	#ifdef TIMING
+	printf("scratch=%u peak=%u ", scratchBytes, peakScratchBytes);
+	#endif
+}
+
+//RLE of changed block part in P-frame: pixel types and run lengths go to wd.runs
+template<class RC>
+void CScreenCapt<RC>::ClassifyBlockP(BYTE *pSrc, WorkerData &wd, int sx1, int sy1, int sx2, int sy2)
+{
+	const int off = -stride - bytespp;
+	int n = 333;
+	int lasti=0;
+	int ptype = 0;
+	for(int y=sy1; y<sy2; y++) {
+		int i = y*stride + sx1*3;
+		for(int x=sx1; x<sx2; x++) {
+			const bool notedge = (x>0) && (y>0);
+			if ((n<255) && (notedge ? PixelTypeFitsP(ptype, &pSrc[i], &prev[i], &pSrc[lasti], off) : PixelTypeFitsP0(ptype, &pSrc[i], &prev[i], &pSrc[lasti]))) {
+				n++;		
+			} else {
+				if (n!=333) 
+					wd.AddRun(ptype, n);
+				ptype = notedge ? GetPixelTypeP(&pSrc[i], &prev[i], off) : GetPixelTypeP0(&pSrc[i], &prev[i]);
+				n = 1;
+			}	
+			lasti = i;
+			i += 3;
+		}
+	}
+	wd.AddRun(ptype, n);
 }
 
 //Determine block types.
@@ -929,6 +1360,7 @@ void CScreenCapt<RC>::DecideBlockTypes(int by_start, int by_size, BYTE *pSrc, Bl
 {
 	int bx1=nbx, bx2=-1, by1=nby, by2=-1;
 	int last_mvx=0, last_mvy=0;
+	int changed = 0, mvfound = 0;
 	const int off = -stride - bytespp;
 
 	int phase = 1; //1: by_start .. by_start+by_size-1;  2: steal from others
@@ -969,8 +1401,8 @@ void CScreenCapt<RC>::DecideBlockTypes(int by_start, int by_size, BYTE *pSrc, Bl
 
 		if (!foundWork) break; // no more work in whole frame!
 
-		int j = by * 16 * X * 5;
-		tls[by].rleStartPos = j;
+		WorkerData &wd = tls[by];
+		wd.runs.clear();
 		for(int bx=0;bx<nbx;bx++) {
 			const int x1 = bx*16;
 			const int x2 = min(bx*16+16, X);
@@ -1040,41 +1472,21 @@ void CScreenCapt<RC>::DecideBlockTypes(int by_start, int by_size, BYTE *pSrc, Bl
 
 					if (FindMV(pSrc, bi, last_mvx, last_mvy, upperBI)) 
 						cp += 2;
-					else { //changed block 
-						int n = 333;
-						int lasti=0;
-						int ptype = 0, lastptype = 0;
-						for(int y=sy1; y<sy2; y++) {
-							int i = y*stride + sx1*3;
-							for(int x=sx1; x<sx2; x++) {
-								const bool notedge = (x>0) && (y>0);
-								if ((n<255) && (notedge ? PixelTypeFitsP(ptype, &pSrc[i], &prev[i], &pSrc[lasti], off) : PixelTypeFitsP0(ptype, &pSrc[i], &prev[i], &pSrc[lasti]))) {
-									n++;		
-								} else {
-									if (n!=333) 
-										rleData[j++] = n;
-									ptype = notedge ? GetPixelTypeP(&pSrc[i], &prev[i], off) : GetPixelTypeP0(&pSrc[i], &prev[i]);
-									rleData[j++] = ptype;
-									n = 1;
-								}	
-								lasti = i;
-								i += 3;
-							}
-						}
-						rleData[j++] = n;
-					}//if not found motion
+					else //changed block 
+						ClassifyBlockP(pSrc, wd, sx1, sy1, sx2, sy2);
 					break;
 				} //if memcmp
 			}//for y
 			bts[bi] = cp;
 			if (thisBlockChanged) {
+				changed++;
+				if (cp > 2) mvfound++;
 				bx1 = min(bx, bx1);
 				by1 = min(by, by1);
 				bx2 = max(bx, bx2);
 				by2 = max(by, by2);
 			}
 		}// for bx
-		tls[by].rleSize = j - tls[by].rleStartPos;
 		justFinished = by;
 	}//while have work (previously: for by)
 
@@ -1084,9 +1496,12 @@ void CScreenCapt<RC>::DecideBlockTypes(int by_start, int by_size, BYTE *pSrc, Bl
 	rgn.by1 = by1==nby ? -1 : by1; 
 	rgn.bx2 = bx2;
 	rgn.by2 = by2;
+	rgn.changed = changed;
+	rgn.mvfound = mvfound;
 }
 
 //compress RGB24 P-frame
+//returns 0 if too much has changed and the frame should be coded as I-frame
 template<class RC>
 int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 {
@@ -1114,14 +1529,26 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 		*pDst = 0;
 		return 1;
 	}
-	*pDst++ = 1; //changes
-	ec.encodeBegin(pDst);
-
 	for(int i=0;i<rowStates.size();i++)
 		rowStates[i] = RowState::Untouched;
-	// determine and encode block types, also fill tls[] rleData[]
+	// determine block types, also fill tls[].runs
 	DecideBlocksParams blockparams(pSrc, nThreads);
 	pSquad->RunParallel(CMD_BLOCKTYPE, &blockparams, this);
+	CountScratch(nby);
+
+	//scene change: most blocks changed and motion search didn't help
+	int nchanged = 0, nmvfound = 0;
+	for(int i=0; i<nThreads; i++) {
+		nchanged += blockparams.regions[i].changed;
+		nmvfound += blockparams.regions[i].mvfound;
+	}
+	lprintf(logF, "changed=%d mvfound=%d\n", nchanged, nmvfound);
+	if (allowSceneCut && nchanged * 100 >= nbx * nby * SC_KF_CHANGED && nmvfound * 100 < nchanged * SC_KF_MVFOUND)
+		return 0;
+
+	*pDst++ = 1; //changes
+	CTraceScope tsEncode("encode P");
+	ec.encodeBegin(pDst);
 
 	#ifdef TIMING
 	QueryPerformanceCounter(&t[3]);
@@ -1143,11 +1570,11 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 
 	//encode indices of first and last blocks which differ from prev. frame
 	int xx1 = by1*nbx + bx1;
-	ec.encodeX(xx1 & 255, xxtab);
-	ec.encodeX((xx1>>8) & 255, xxtab);
+	for(int k=0; k<xxBytes; k++)
+		ec.encodeX((xx1>>(k*8)) & 255, xxtab);
 	int xx2 = by2*nbx + bx2;
-	ec.encodeX(xx2 & 255, xxtab);
-	ec.encodeX((xx2>>8) & 255, xxtab);
+	for(int k=0; k<xxBytes; k++)
+		ec.encodeX((xx2>>(k*8)) & 255, xxtab);
 	 
 	lprintf(logF, "xx1=%d xx2=%d\n",xx1,xx2);
 	//encode block types for blocks between those two indices
@@ -1175,9 +1602,10 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 	n = -1; 
 	cx = cx1 = 0;
 	int lastmx=0, lastmy=0;
-	int band = 0, j = 0;
+	int j = 0;
 	for(uint by=0;by<nby;by++) {
-		j = tls[by].rleStartPos;
+		const BYTE *runs = tls[by].runs.size() > 0 ? &tls[by].runs[0] : NULL;
+		j = 0;
 		for(uint bx=0;bx<nbx;bx++) {
 			int bi = by*nbx+bx;
 			if (bts[bi])	{
@@ -1203,8 +1631,7 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 							ec.encodeBool(true);
 						} else {
 							ec.encodeBool(false);
-							ec.encodeMX(mvs[0][bi]+msr_x, mvtab[0]);
-							ec.encodeMY(mvs[1][bi]+msr_y, mvtab[1]);
+							EncodeMV(mvs[0][bi], mvs[1][bi]);
 							lastmx = mvs[0][bi]; lastmy = mvs[1][bi];
 						}
 					} else {//V2 
@@ -1218,8 +1645,8 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 					int lastptype = 0, i = 0;
 					CheckDstLength(&ec.pDst, &pDST);
 					while(y<y2) {
-						int ptype = rleData[j++];
-						int n = rleData[j++];
+						int ptype, n;
+						GetRun(runs, j, ptype, n);
 						i = y*stride + x*3;
 
 						WritePixel(ptype, lastptype, &pSrc[i]);
@@ -1248,9 +1675,11 @@ int CScreenCapt<RC>::CompressP(BYTE *pSrc, BYTE *pDST)
 	}//by
 	CheckDstLength(&ec.pDst, &pDST);
 	pDst = ec.encodeEnd();
+	tsEncode.End();
 	#ifdef TIMING
 	QueryPerformanceCounter(&t[5]);
 	#endif
+	CTraceScope tsCopy("memcpy prev");
 	memcpy(prev, pSrc, Y*stride); //remember current frame as previous for the next one
 	if (saveBuffer.size() > 0)
 		saveBuffer.resize(pDst - pDST);
@@ -1287,19 +1716,19 @@ int CScreenCapt<RC>::DecompressP(BYTE *pSrc, int srcLength, BYTE *pDst)
 	//if the frame doesn't differ from previous, just copy and exit
 	if (!changes) {
 		memcpy(pDst, prev, Y*stride);
+		changedRects.clear();
 		return 1;
 	}
+	CTraceScope ts("decode P");
 	ec.decodeBegin(pSrc, srcLength);
 
 	
 	//decode first and last indices of blocks that differ
-	int t,xx1,xx2;
-	t = ec.decodeX(xxtab);
-	xx1 = ec.decodeX(xxtab);
-	xx1 = (xx1<<8)+t;
-	t = ec.decodeX(xxtab);
-	xx2 = ec.decodeX(xxtab);
-	xx2 = (xx2<<8)+t;
+	int xx1 = 0, xx2 = 0;
+	for(int k=0; k<xxBytes; k++)
+		xx1 += ec.decodeX(xxtab) << (k*8);
+	for(int k=0; k<xxBytes; k++)
+		xx2 += ec.decodeX(xxtab) << (k*8);
 
 	lprintf(logF, "xx1=%d xx2=%d\n",xx1,xx2);
 	//decode block types
@@ -1311,6 +1740,7 @@ int CScreenCapt<RC>::DecompressP(BYTE *pSrc, int srcLength, BYTE *pDst)
 		for(int i=0; i<n; i++)
 			bts[x++] = c;		
 	}
+	CollectChangedRects();
 
 	//decode blocks
 	const int off = -stride-3;
@@ -1351,10 +1781,8 @@ int CScreenCapt<RC>::DecompressP(BYTE *pSrc, int srcLength, BYTE *pDst)
 						bool same = ec.decodeBool();
 						if (same) {
 							mx = lastmx; my = lastmy;
-						} else {
-							mx = ec.decodeMX(mvtab[0]) - msr_x;
-							my = ec.decodeMY(mvtab[1]) - msr_y;
-						}
+						} else 
+							DecodeMV(mx, my);
 					} else {//V2
 						mx = ec.decodeMX(mvtab[0]) - msr_x;
 						my = ec.decodeMY(mvtab[1]) - msr_y;
@@ -1431,6 +1859,37 @@ int CScreenCapt<RC>::DecompressP(BYTE *pSrc, int srcLength, BYTE *pDst)
 	return 1;
 }
 
+//runs of changed blocks in a block row become rectangles,
+//a run of same horizontal extent as one in the row above extends that rectangle down
+template<class RC>
+void CScreenCapt<RC>::CollectChangedRects()
+{
+	changedRects.clear();
+	std::vector<int> above, cur; //rectangles reaching previous / current block row, left to right
+	for(uint by=0; by<nby; by++) {
+		const int y1 = by*16, y2 = min(y1 + 16, Y);
+		const BYTE *b = &bts[by*nbx];
+		size_t k = 0;
+		cur.clear();
+		for(uint bx=0; bx<nbx; ) {
+			if (!b[bx]) { bx++; continue; }
+			const int x1 = bx*16;
+			while(bx < nbx && b[bx]) bx++;
+			const int x2 = min((int)bx*16, X);
+			while(k < above.size() && changedRects[above[k]].x1 < x1) k++;
+			if (k < above.size() && changedRects[above[k]].x1==x1 && changedRects[above[k]].x2==x2) {
+				changedRects[above[k]].y2 = y2;
+				cur.push_back(above[k]);
+			} else {
+				FrameRect rc = { x1, y1, x2, y2 };
+				cur.push_back(changedRects.size());
+				changedRects.push_back(rc);
+			}
+		}
+		above.swap(cur);
+	}
+}
+
 //is whole frame filled with one color?
 template<class RC>
 BOOL CScreenCapt<RC>::IsFlat(BYTE *pSrc)
@@ -1450,21 +1909,26 @@ BOOL CScreenCapt<RC>::IsFlat(BYTE *pSrc)
 //template<> int GetSPVersion<UseRC>() { return 2; }
 //template<> int GetSPVersion<UseANS>() { return 3; }
 
+template<class RC>
+void CScreenCapt<RC>::StartSquad()
+{
+	if (pSquad) return;
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	pSquad = new CSquad(nThreads > 0 ? nThreads : info.dwNumberOfProcessors);
+	tls.resize(max((int)nby, pSquad->NumThreads())); //a band or a block row for each
+	rowStates.resize(nby);
+	#ifdef TIMING
+	runCmdTimes.resize(pSquad->NumThreads());
+	#endif
+}
+
 //compress a frame
 //works in any colorspace because calls virtual methods
 template<class RC>
 int CScreenCapt<RC>::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype) //frame type 0-I, 1-P
 {
-	if (!pSquad) {
-		SYSTEM_INFO info;
-		GetSystemInfo(&info);
-		pSquad = new CSquad(info.dwNumberOfProcessors);
-		tls.resize(nby); 
-		rowStates.resize(nby);
-		#ifdef TIMING
-		runCmdTimes.resize(pSquad->NumThreads());
-		#endif
-	}
+	StartSquad();
 
 	const int version = myVersion;// GetSPVersion<RC>();
 
@@ -1474,7 +1938,7 @@ int CScreenCapt<RC>::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &f
 		int real_size = saved + (last_ftype==0 ? 1 : 0);
 		if (dstLength >= real_size) {
 			if (last_ftype==0) {
-				*pDst++ = 2 + (version-1)*16; 
+				*pDst++ = (last_was_static ? SC_STATIC_I : 2) + (version-1)*16; 
 			}
 			memcpy(pDst, &saveBuffer[0], saved);
 			saveBuffer.resize(0);
@@ -1482,7 +1946,9 @@ int CScreenCapt<RC>::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &f
 		return real_size; 
 	}
 
+	if (countUsage) counts.Clear();
 	pDstEnd = pDst + dstLength - 32; // if pDst goes past this point, switch to larger buffer
+	allowSceneCut = last_ftype!=0 || last_was_flat; //two full I-frames in a row don't help
 
 	// if it's filled with one color, just mark so and store this color. It's an I-frame! 
 	if (IsFlat(pSrc)) {
@@ -1502,16 +1968,26 @@ int CScreenCapt<RC>::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &f
 	int csz = 0;
 
 	if (fn && ftype) { //if it's not first frame and we're asked to make a P-frame, compress it as P-frame
-		last_ftype = ftype = 1; fn++;
+		last_ftype = ftype = 1; 
 		csz = CompressP(pSrc, pDst);
-	} else { //otherwise compress as I-frame
-		last_ftype = ftype = 0; fn++;		
-		*pDst++ = 2 + (version-1)*16; 
-		csz = CompressI(pSrc, pDst)+1;
+		if (csz==0) //scene change, I-frame will be smaller
+			ftype = 0;
 	}
+	if (!fn || !ftype) { //otherwise compress as I-frame
+		last_ftype = ftype = 0; 
+		last_was_static = staticI;
+		if (staticI) {
+			*pDst++ = SC_STATIC_I + (version-1)*16;
+			csz = CompressIStatic(pSrc, pDst)+1;
+		} else {
+			*pDst++ = 2 + (version-1)*16; 
+			csz = CompressI(pSrc, pDst)+1;
+		}
+	}
+	fn++;
 
 	if (csz <= dstLength && saveBuffer.size() > 0) { //switched to buffer but not really needed
-		memcpy(pDst, &saveBuffer[0], csz);
+		memcpy(pDst, &saveBuffer[0], saveBuffer.size()); //all but the I-frame byte already written
 		saveBuffer.resize(0);
 	}
 	return csz;
@@ -1528,12 +2004,15 @@ int CScreenCapt<RC>::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int
 	}
 	lprintf(logF, "DecompressFrame fn=%d len=%d\n", fn, srcLength);
 	fn++;
+	if (countUsage) counts.Clear();
+	FrameRect whole = { 0, 0, X, Y };
+	changedRects.assign(1, whole);
 	if (ftype)  {//P
 		last_was_flat = false;
 		return DecompressP(pSrc, srcLength, pDst);
 	}
 	// I
-	int alg = (*pSrc++) & 0x0F;
+	int alg = (*pSrc++) & 0x07;
 	if (alg==1) {
 		lprintf(logF, "alg==1 \n");
 		for(int x=0;x<X;x++) 
@@ -1547,19 +2026,435 @@ int CScreenCapt<RC>::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int
 		if (!(last_was_flat && 0==memcmp(&last_flat_clr[0], pSrc, bytespp))) {
 			memcpy(prev, pDst, Y*stride);
 			RenewI();
-		}
+		} else
+			changedRects.clear();
 		last_was_flat = true;
 		memcpy(&last_flat_clr[0],pSrc, bytespp);
 		return 1;
 	} else
 		last_was_flat = false;
+	if (alg==SC_STATIC_I)
+		return DecompressIStatic(pSrc, srcLength-1, pDst);
 	return DecompressI(pSrc, srcLength, pDst);
 }
 ///////////////////////////////////////////////////////////////////////
 
+template<class RC>
+void CScreenCapt<RC>::CountContextUsage(bool on)
+{
+	countUsage = on;
+	counts.Clear();
+	ec.setCounts(on ? &counts : NULL);
+}
+
+template<class RC>
+void CScreenCapt<RC>::GetContextUsage(ContextUsage &u)
+{
+	u.codecBytes += sizeof(*this);
+	if (!init) return;
+	for(int i=0;i<3;i++)
+		for(int j=0;j<SC_CXMAX;j++) {
+			u.kinds[ec.kindC(cntab[i][j])]++;
+			u.contextBytes += ec.heapBytesC(cntab[i][j]);
+		}
+	u.contextBytes += ec.heapBytesNM();
+	u.bufferBytes += Y*stride + nbx*nby*(1 + 6*sizeof(int)) + saveBuffer.capacity(); //prev, bts, sxy, mvs
+	u.bufferBytes += ec.heapBytesBuf();
+	for(size_t i=0;i<tls.size();i++)
+		u.bufferBytes += tls[i].runs.capacity();
+	for(int k=0;k<8;k++)
+		u.upgrades[k] += counts.upgrades[k];
+	u.symbols += counts.symbols;
+	u.bypassed += counts.bypassed;
+}
+///////////////////////////////////////////////////////////////////////
+
+//RGB24 codec of given bitstream version
+IScreenCapt* CreateScreenCapt(int version)
+{
+	IScreenCapt *pSC = NULL;
+	switch(version) {
+		case 2: pSC = new CScreenCapt<UseRC>(version); break;
+		case 3: pSC = new CScreenCapt<UseANS>(version); pSC->setCx6f0(64); break;
+		case 4: 
+		case 5: pSC = new CScreenCapt<UseANS>(version); pSC->setCx6f0(32); break;
+		case 6: pSC = new CScreenCapt<UseANS15>(version); pSC->setCx6f0(32); break;
+		default: throw BadVersionException(version);
+	}
+	return pSC;
+}
+
+//motion search effort of encoder speed presets, decoder doesn't depend on them
+void SetSpeedPreset(CodecParameters *pParams, int preset)
+{
+	static const uint far_range[] = { 0, 64, 256, 1024 }; //0: only last and upper vectors, no line scans; above 256 only in v5+
+	static const uint near_range[] = { 2, 4, 8, 16 };
+	if (preset < SC_PRESET_ULTRAFAST || preset > SC_PRESET_MAX)
+		preset = SC_PRESET_DEFAULT;
+	pParams->high_range_x = pParams->high_range_y = far_range[preset];
+	pParams->low_range_x = pParams->low_range_y = near_range[preset];
+}
+
+///////////////////////////////////////////////////////////////////////
+
+CTiledScreenCapt::CTiledScreenCapt(int ver)
+: myVersion(ver), X(0), Y(0), stride(0), tsize(0), ntx(0), nty(0), stats(NULL), countUsage(false), pSquad(NULL), nThreads(0), loss(0), nextTile(0), last_ftype(0)
+{
+	InitializeCriticalSection(&tilesCritSec);
+}
+
+CTiledScreenCapt::~CTiledScreenCapt()
+{
+	Deinit();
+	DeleteCriticalSection(&tilesCritSec);
+}
+
+void CTiledScreenCapt::Init(CodecParameters *pParams)
+{
+	Deinit();
+	X = pParams->width; Y = pParams->height;
+	stride = (X * 3 + 3) & (~3);
+	nThreads = pParams->threads;
+	loss = pParams->loss;
+	tileParams = *pParams;
+	tileParams.bits_per_pixel = 24;
+	tileParams.threads = 1; //tiles are processed in parallel, so each tile uses one thread
+	tileParams.tile_size = 0;
+	viewport.x1 = 0; viewport.y1 = 0; viewport.x2 = X; viewport.y2 = Y;
+	if (pParams->tile_size > 0) //when decoding tile size comes with the first I-frame
+		CreateTiles(pParams->tile_size);
+}
+
+void CTiledScreenCapt::CreateTiles(int tile_size)
+{
+	FreeTiles();
+	tsize = tile_size;
+	ntx = (X + tsize - 1) / tsize;
+	nty = (Y + tsize - 1) / tsize;
+	const int n = ntx * nty;
+	tiles.resize(n); tileImg.resize(n); tileData.resize(n); tileSrc.resize(n);
+	tileLen.resize(n); tileType.resize(n);
+	flatClr.assign(n, -1);
+	stale.assign(n, 0);
+	decoded.assign(n, 0);
+	tileStats.assign(n, BitStats());
+	tileParams.loss = loss;
+	for(int t=0;t<n;t++) {
+		FrameRect rc;
+		GetTileRect(t, rc);
+		tileParams.width = rc.x2 - rc.x1;
+		tileParams.height = rc.y2 - rc.y1;
+		tiles[t] = CreateScreenCapt(myVersion);
+		tiles[t]->Init(&tileParams);
+		tiles[t]->SetBitStats(stats ? &tileStats[t] : NULL);
+		tiles[t]->CountContextUsage(countUsage);
+		tileImg[t].resize(TileStride(t) * tileParams.height, 0);
+	}
+}
+
+void CTiledScreenCapt::FreeTiles()
+{
+	for(size_t t=0;t<tiles.size();t++) {
+		tiles[t]->Deinit(); //also stops rANS worker of the tile
+		delete tiles[t];
+	}
+	tiles.clear(); tileImg.clear(); tileData.clear();
+}
+
+void CTiledScreenCapt::Deinit()
+{
+	FreeTiles();
+	if (pSquad) {
+		delete pSquad;
+		pSquad = NULL;
+	}
+}
+
+void CTiledScreenCapt::SetupLossMask(int l)
+{
+	loss = l;
+	for(size_t t=0;t<tiles.size();t++)
+		tiles[t]->SetupLossMask(l);
+}
+
+void CTiledScreenCapt::setCx6f0(int f0) {} //tiles get it from CreateScreenCapt
+
+void CTiledScreenCapt::GetTileRect(int t, FrameRect &rc)
+{
+	rc.x1 = (t % ntx) * tsize;
+	rc.y1 = (t / ntx) * tsize;
+	rc.x2 = min(rc.x1 + tsize, X);
+	rc.y2 = min(rc.y1 + tsize, Y);
+}
+
+int CTiledScreenCapt::TileStride(int t)
+{
+	FrameRect rc;
+	GetTileRect(t, rc);
+	return ((rc.x2 - rc.x1) * 3 + 3) & (~3);
+}
+
+//copy picture of a tile from the frame or to the frame
+void CTiledScreenCapt::CopyTile(int t, BYTE *pFrame, bool toFrame)
+{
+	FrameRect rc;
+	GetTileRect(t, rc);
+	const int tstride = TileStride(t);
+	const int width_bytes = (rc.x2 - rc.x1) * 3;
+	for(int y=rc.y1; y<rc.y2; y++) {
+		BYTE *pf = &pFrame[y*stride + rc.x1*3];
+		BYTE *pt = &tileImg[t][(y - rc.y1)*tstride];
+		if (toFrame)
+			memcpy(pf, pt, width_bytes);
+		else
+			memcpy(pt, pf, width_bytes);
+	}
+}
+
+//tiles differ in complexity, so workers take them one by one
+int CTiledScreenCapt::GrabTile()
+{
+	EnterCriticalSection(&tilesCritSec);
+	const int t = nextTile < (int)tiles.size() ? nextTile++ : -1;
+	LeaveCriticalSection(&tilesCritSec);
+	return t;
+}
+
+void CTiledScreenCapt::RunCommand(int command, void *params, CSquadWorker *sqworker)
+{
+	TileJobParams *job = (TileJobParams*)params;
+	int t;
+	while((t = GrabTile()) >= 0) {
+		FrameRect rc;
+		GetTileRect(t, rc);
+		CTraceScope ts(cmdNames[command], t);
+		switch(command) {
+		case CMD_TILES_COMPRESS: {
+			const int maxLen = (rc.x2 - rc.x1) * (rc.y2 - rc.y1) * 6 + 1024;
+			if ((int)tileData[t].size() < maxLen)
+				tileData[t].resize(maxLen);
+			CopyTile(t, job->pFrame, false);
+			int ftype = job->ftype;
+			tileLen[t] = tiles[t]->CompressFrame(&tileImg[t][0], &tileData[t][0], maxLen, ftype);
+			BYTE *d = &tileData[t][0];
+			if (ftype==0 && tileLen[t]==4 && (d[0] & 0x07)==1) { //flat tile is always an I-frame
+				const int clr = d[1] | (d[2]<<8) | (d[3]<<16);
+				if (job->ftype && clr==flatClr[t]) { //same color as before, decoder has it already
+					d[0] = 0; tileLen[t] = 1;
+					ftype = 1;
+				}
+				flatClr[t] = clr;
+			} else
+				flatClr[t] = -1;
+			tileType[t] = ftype;
+			break;
+		}
+		case CMD_TILES_DECOMPRESS: {
+			//unchanged tile keeps decoder state in sync even if we don't decode it
+			const bool unchanged = tileType[t] && tileLen[t]==1 && tileSrc[t][0]==0;
+			const bool visible = rc.x1 < viewport.x2 && rc.x2 > viewport.x1 && rc.y1 < viewport.y2 && rc.y2 > viewport.y1;
+			decoded[t] = 0;
+			if (!unchanged) {
+				if (visible && (!stale[t] || tileType[t]==0)) {
+					tiles[t]->DecompressFrame(tileSrc[t], tileLen[t], &tileImg[t][0], tileType[t]);
+					stale[t] = 0;
+					decoded[t] = 1;
+				} else
+					stale[t] = 1;
+			}
+			if (!decoded[t] && countUsage) //tile not decoded, its counters would stay from older frame
+				tiles[t]->CountContextUsage(true);
+			CopyTile(t, job->pFrame, true);
+			break;
+		}
+		}//switch
+	}
+}
+
+//frame: 
+// I: [SC_TILED + (version-1)*16] [tile size / 16] [tile index] [tile streams]
+// P: [0] - no changes at all, or [1] [tile index] [tile streams]
+//tile index: 4 bytes for each tile, size of its stream, highest bit set for I-frames
+int CTiledScreenCapt::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype) //frame type 0-I, 1-P
+{
+	const int saved = saveBuffer.size();
+	if (saved > 0) { // return previously saved data
+		ftype = last_ftype;
+		if (dstLength >= saved) {
+			memcpy(pDst, &saveBuffer[0], saved);
+			saveBuffer.resize(0);
+		}
+		return saved;
+	}
+
+	const int n = tiles.size();
+	if (!pSquad) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		const int nt = nThreads > 0 ? nThreads : info.dwNumberOfProcessors;
+		pSquad = new CSquad(min(nt, n), 1024*1024); //rANS coder of a tile needs a big stack
+	}
+	TileJobParams job;
+	job.pFrame = pSrc; job.ftype = ftype;
+	nextTile = 0;
+	pSquad->RunParallel(CMD_TILES_COMPRESS, &job, this);
+	if (stats) 
+		for(int t=0;t<n;t++) {
+			stats->Add(tileStats[t]);
+			tileStats[t].Clear();
+		}
+
+	bool allI = true, changes = false;
+	for(int t=0;t<n;t++) {
+		if (tileType[t]) allI = false;
+		if (tileType[t]==0 || tileLen[t] > 1 || tileData[t][0] != 0) changes = true;
+	}
+	last_ftype = ftype = allI ? 0 : 1;
+	if (!allI && !changes) {
+		*pDst = 0;
+		return 1;
+	}
+	int csz = (allI ? 2 : 1) + n*4;
+	for(int t=0;t<n;t++)
+		csz += tileLen[t];
+	BYTE *p = pDst;
+	if (csz > dstLength) { //caller will come again with a bigger buffer
+		saveBuffer.resize(csz);
+		p = &saveBuffer[0];
+	}
+	if (allI) {
+		*p++ = SC_TILED + (myVersion-1)*16;
+		*p++ = tsize / 16;
+	} else
+		*p++ = 1;
+	for(int t=0;t<n;t++) {
+		const DWORD v = tileLen[t] | (tileType[t] ? 0 : 0x80000000);
+		memcpy(p, &v, 4);
+		p += 4;
+	}
+	for(int t=0;t<n;t++) {
+		memcpy(p, &tileData[t][0], tileLen[t]);
+		p += tileLen[t];
+	}
+	return csz;
+}
+
+int CTiledScreenCapt::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int ftype)
+{
+	if (X & 3) {
+		for(int y=0; y<Y; y++)
+			memset(&pDst[y*stride+X*3], 0, stride - X*3);
+	}
+	BYTE *p = pSrc;
+	if (ftype==0) {
+		if (srcLength < 2) return 0;
+		const int tile_size = p[1] * 16;
+		if (tile_size==0) return 0;
+		p += 2;
+		if (tile_size != tsize || tiles.size()==0)
+			CreateTiles(tile_size);
+	} else {
+		if (tiles.size()==0 || srcLength < 1) return 0; //P-frame before any I
+		if (*p++ == 0) { //no changes
+			for(size_t t=0;t<tiles.size();t++)
+				CopyTile(t, pDst, true);
+			decoded.assign(tiles.size(), 0);
+			return 1;
+		}
+	}
+	const int n = tiles.size();
+	if ((p - pSrc) + n*4 > srcLength) return 0;
+	for(int t=0;t<n;t++) {
+		DWORD v;
+		memcpy(&v, p, 4);
+		p += 4;
+		tileLen[t] = v & 0x7FFFFFFF;
+		tileType[t] = (v & 0x80000000) ? 0 : 1;
+	}
+	for(int t=0;t<n;t++) {
+		if (tileLen[t] > pSrc + srcLength - p) return 0;
+		tileSrc[t] = p;
+		p += tileLen[t];
+	}
+
+	if (!pSquad) {
+		SYSTEM_INFO info;
+		GetSystemInfo(&info);
+		const int nt = nThreads > 0 ? nThreads : info.dwNumberOfProcessors;
+		pSquad = new CSquad(min(nt, n));
+	}
+	TileJobParams job;
+	job.pFrame = pDst; job.ftype = ftype;
+	nextTile = 0;
+	pSquad->RunParallel(CMD_TILES_DECOMPRESS, &job, this);
+	return 1;
+}
+
+void CTiledScreenCapt::SetViewport(const FrameRect &rc)
+{
+	viewport.x1 = max(rc.x1, 0);
+	viewport.y1 = max(rc.y1, 0);
+	viewport.x2 = min(rc.x2, X);
+	viewport.y2 = min(rc.y2, Y);
+}
+
+void CTiledScreenCapt::GetStaleRects(std::vector<FrameRect> &rects)
+{
+	rects.clear();
+	for(size_t t=0;t<stale.size();t++)
+		if (stale[t]) {
+			FrameRect rc;
+			GetTileRect(t, rc);
+			rects.push_back(rc);
+		}
+}
+
+void CTiledScreenCapt::SetBitStats(BitStats *pStats)
+{
+	stats = pStats;
+	for(size_t t=0;t<tiles.size();t++)
+		tiles[t]->SetBitStats(stats ? &tileStats[t] : NULL);
+}
+
+void CTiledScreenCapt::CountContextUsage(bool on)
+{
+	countUsage = on;
+	for(size_t t=0;t<tiles.size();t++)
+		tiles[t]->CountContextUsage(on);
+}
+
+void CTiledScreenCapt::GetContextUsage(ContextUsage &u)
+{
+	u.codecBytes += sizeof(*this);
+	for(size_t t=0;t<tiles.size();t++) {
+		tiles[t]->GetContextUsage(u);
+		u.bufferBytes += tileImg[t].capacity() + tileData[t].capacity();
+	}
+}
+
+//changed rectangles of decoded tiles, moved to frame coordinates
+void CTiledScreenCapt::GetChangedRects(std::vector<FrameRect> &rects)
+{
+	rects.clear();
+	std::vector<FrameRect> tileRects;
+	for(size_t t=0;t<decoded.size();t++)
+		if (decoded[t]) {
+			FrameRect rc;
+			GetTileRect(t, rc);
+			tiles[t]->GetChangedRects(tileRects);
+			for(size_t i=0;i<tileRects.size();i++) {
+				FrameRect r = tileRects[i];
+				r.x1 += rc.x1; r.x2 += rc.x1; r.y1 += rc.y1; r.y2 += rc.y1;
+				rects.push_back(r);
+			}
+		}
+}
+
+///////////////////////////////////////////////////////////////////////
+
 ScreenCodec::ScreenCodec()
 : pSC(NULL), rgb32(false), rgb16(false), bufsize(0), 
-  X(0), Y(0), stride(0), crashed(false), last_loss(0)
+  X(0), Y(0), stride(0), crashed(false), last_loss(0), tiled(false), pAlpha(NULL), rgba_pending(0), rgba_pending_type(0), yuv(0), outScale(0), collectStats(false), trackUsage(false)
 { }
 
 void ScreenCodec::Init(CodecParameters *pParams)
@@ -1571,6 +2466,15 @@ void ScreenCodec::Init(CodecParameters *pParams)
 	rgb32 = pParams->bits_per_pixel==32;
 	rgb16 = pParams->bits_per_pixel==16;
 	last_loss = pParams->loss;
+	viewport.x1 = 0; viewport.y1 = 0; viewport.x2 = X; viewport.y2 = Y;
+	yuv = pParams->yuv;
+	if (yuv) { //planes are converted to/from rgb_buffer, it's our only frame layout
+		bpp = 3;
+		stride = (X * 3 + 3) & (~3);
+		params.bits_per_pixel = 24;
+	}
+	if (params.tile_size > 0) 
+		params.tile_size = min(max((params.tile_size + 15) & (~15), 64), SC_MAXTILE);
 
 	redshift = 0; greenshift = 0; blueshift = 0;
 	if (rgb16) {
@@ -1584,12 +2488,16 @@ void ScreenCodec::Init(CodecParameters *pParams)
 }
 
 //init pSC, params must be filled in. version: 1 for old RC, 2 for RCSub
-void ScreenCodec::CreateCodec(int version) 
+void ScreenCodec::CreateCodec(int version, bool tiles, bool alpha) 
 {
-	if (version < 2 || version > 4)
+	if (version < 2 || version > SC_VERSION)
 		throw BadVersionException(version);
 	// CreateCodec is called from (De)CompressFrame, after Init, so we know stride here
 	const int stride24 = (X * 3 + 3) & (~3);
+	if (yuv) {
+		bufsize = stride24 * Y;
+		rgb_buffer.resize(bufsize, 0);
+	} else
 	switch(params.bits_per_pixel) {
 	case 16:
 		rgb16 = true;
@@ -1608,12 +2516,29 @@ void ScreenCodec::CreateCodec(int version)
 		printf("Incorrect bits_per_pixel value!\n");
 		throw BadVersionException(48);
 	}
-	switch(version) {
-		case 2: pSC = new CScreenCapt<UseRC>(version); break;
-		case 3: pSC = new CScreenCapt<UseANS>(version); pSC->setCx6f0(64); break;
-		case 4: pSC = new CScreenCapt<UseANS>(version); pSC->setCx6f0(32); break;
-	}
+	tiled = tiles;
+	pSC = tiles ? new CTiledScreenCapt(version) : CreateScreenCapt(version);
 	pSC->Init(&params);
+	pSC->SetViewport(viewport);
+	pSC->SetBitStats(collectStats ? &frameStats : NULL);
+	pSC->CountContextUsage(trackUsage);
+	if (alpha) {
+		CodecParameters ap = params;
+		ap.loss = 0; ap.adaptive_loss = 0; ap.tile_size = 0;
+		alpha_buffer.resize(stride24 * Y, 0);
+		pAlpha = CreateScreenCapt(version);
+		pAlpha->Init(&ap);
+		pAlpha->SetBitStats(collectStats ? &alphaStats : NULL);
+		pAlpha->CountContextUsage(trackUsage);
+	}
+}
+
+//v6 only on request (static key frames need it too), otherwise v4 as long as the frame fits
+int ScreenCodec::EncoderVersion() const
+{
+	if (params.bitstream_v6 || params.static_iframes)
+		return 6;
+	return (X > SC_V4_MAXSIZE || Y > SC_V4_MAXSIZE) ? 5 : 4;
 }
 
 void ScreenCodec::Deinit()
@@ -1624,7 +2549,15 @@ void ScreenCodec::Deinit()
 		delete pSC;
 		pSC = NULL;
 	}
+	if (pAlpha) {
+		pAlpha->Deinit();
+		delete pAlpha;
+		pAlpha = NULL;
+	}
 	rgb_buffer.clear();
+	alpha_buffer.clear();
+	rgba_buffer.clear();
+	rgba_pending = 0;
 	rgb32 = false; rgb16 = false;
 }
 
@@ -1632,6 +2565,7 @@ void ScreenCodec::Deinit()
 int ScreenCodec::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype, int loss) //frame type 0-I, 1-P
 {
 	if (crashed) return 0;
+	CTraceScope ts("CompressFrame");
 	if (loss != last_loss) {
 		pSC->SetupLossMask(loss);
 		last_loss = loss;
@@ -1644,11 +2578,40 @@ int ScreenCodec::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype
 	QueryPerformanceCounter(&t0);
 	#endif
 	if (!pSC) {
-		CreateCodec(4);
+		CreateCodec(EncoderVersion(), params.tile_size > 0, params.alpha > 0 && rgb32);
+	}
+	if (rgba_pending > 0) { // return RGBA frame saved last time
+		const int sz = rgba_pending;
+		ftype = rgba_pending_type;
+		if (dstLength >= sz) {
+			memcpy(pDst, &rgba_buffer[0], sz);
+			rgba_pending = 0;
+			if (trackUsage) FrameUsageDone();
+		}
+		return sz;
 	}
 	#ifdef TIMING
 	QueryPerformanceCounter(&t1);
 	#endif
+	CTraceScope tsConv("convert in");
+	if (yuv) {
+		PackYUV(pSrc);
+		pSrc = &rgb_buffer[0];
+	} else
+	if (pAlpha) {
+		const int stride24 = (X * 3 + 3) & (~3);
+		for(uint y=0;y<Y; y++) {
+			uint i = y*X*4, j = y*stride24;
+			for(int x=0; x < X; x++) {
+				rgb_buffer[j]   = pSrc[i];
+				rgb_buffer[j+1] = pSrc[i+1];
+				rgb_buffer[j+2] = pSrc[i+2];
+				alpha_buffer[j] = alpha_buffer[j+1] = alpha_buffer[j+2] = pSrc[i+3];
+				i+=4; j+=3;
+			}
+		}
+		pSrc = &rgb_buffer[0];
+	} else
 	if (rgb32) {	
 		const int stride24 = (X * 3 + 3) & (~3);
 		for(uint y=0;y<Y; y++) {
@@ -1679,7 +2642,39 @@ int ScreenCodec::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype
 	#ifdef TIMING
 	QueryPerformanceCounter(&t2);
 	#endif
-	auto ret = pSC->CompressFrame(pSrc, pDst, dstLength, ftype);
+	tsConv.End();
+	frameStats.Clear();
+	int ret;
+	if (pAlpha) { //rgb and alpha go to rgba_buffer, then to pDst if the whole thing fits
+		const int rsz = CompressPart(pSC, pSrc, 0, ftype);
+		//alpha is a key frame whenever rgb is, so the whole frame is a key frame
+		int aftype = ftype;
+		CTraceScope tsAlpha("alpha");
+		const int asz = CompressPart(pAlpha, &alpha_buffer[0], rsz, aftype);
+		ret = rsz + asz + 4;
+		if ((int)rgba_buffer.size() < ret)
+			rgba_buffer.resize(ret);
+		BYTE *p = &rgba_buffer[0];
+		if (ftype==0)
+			p[0] |= SC_ALPHA;
+		p[rsz+asz] = rsz & 255; p[rsz+asz+1] = (rsz>>8) & 255; 
+		p[rsz+asz+2] = (rsz>>16) & 255; p[rsz+asz+3] = (rsz>>24) & 255;
+		if (ret <= dstLength)
+			memcpy(pDst, p, ret);
+		else { //won't fit, next call returns it
+			rgba_pending = ret;
+			rgba_pending_type = ftype;
+		}
+	} else
+		ret = pSC->CompressFrame(pSrc, pDst, dstLength, ftype);
+	if (collectStats) {
+		frameStats.Add(alphaStats);
+		alphaStats.Clear();
+		frameStats.frames = 1;
+		totalStats.Add(frameStats);
+	}
+	if (trackUsage && ret <= dstLength) //otherwise the frame comes again from save buffer
+		FrameUsageDone();
 	#ifdef TIMING
 	QueryPerformanceCounter(&t3);
 	printf(" CpFr: Create=%lf rgb24=%lf CF=%lf ", 
@@ -1691,25 +2686,68 @@ int ScreenCodec::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype
 	return ret;
 }
 
+//compress one part of RGBA frame into rgba_buffer at pos, taking it from p's save buffer if needed
+int ScreenCodec::CompressPart(IScreenCapt *p, BYTE *pSrc, int pos, int &ftype)
+{
+	if (rgba_buffer.size() < pos + bufsize)
+		rgba_buffer.resize(pos + bufsize);
+	int sz = p->CompressFrame(pSrc, &rgba_buffer[pos], rgba_buffer.size() - pos, ftype);
+	if (pos + sz > (int)rgba_buffer.size()) { //went to p's save buffer, get it from there
+		rgba_buffer.resize(pos + sz);
+		sz = p->CompressFrame(pSrc, &rgba_buffer[pos], sz, ftype);
+	}
+	return sz;
+}
+
+//frame dropped by rate control: decoder keeps showing the last one,
+//codecs keep it as reference since they don't see this frame at all
+int ScreenCodec::SkipFrame(BYTE *pDst)
+{
+	pDst[0] = 0; //no changes
+	if (!pAlpha)
+		return 1;
+	pDst[1] = 0; //no changes in alpha
+	pDst[2] = 1; pDst[3] = pDst[4] = pDst[5] = 0; //size of rgb part
+	return 6;
+}
+
 // call the decompressor and convert to RGB32 if necessary
 int ScreenCodec::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int pitch, int ftype)
 {
 	if (crashed && ftype > 0) return 0;
+	CTraceScope ts("DecompressFrame");
 	if (!pSC) {
 		if (ftype > 0) return 0; //P frame before any I
 		int version = (pSrc[0] >> 4) + 1;
-		CreateCodec(version);
+		CreateCodec(version, (pSrc[0] & 0x07)==SC_TILED, (pSrc[0] & SC_ALPHA)!=0);
+	}
+	if (pAlpha) { //split RGBA frame, alpha part can be an I-frame in a P-frame
+		if (srcLength < 6) return 0;
+		const int rgbLength = pSrc[srcLength-4] | (pSrc[srcLength-3]<<8) | (pSrc[srcLength-2]<<16) | (pSrc[srcLength-1]<<24);
+		if (rgbLength <= 0 || rgbLength >= srcLength - 4) return 0;
+		BYTE *pA = pSrc + rgbLength;
+		pAlpha->DecompressFrame(pA, srcLength - 4 - rgbLength, &alpha_buffer[0], *pA > 1 ? 0 : 1);
+		srcLength = rgbLength;
 	}
 
-	bool useBuffer = rgb32 || rgb16;
-	if (pitch != stride) {
-		rgb_buffer.resize(stride*Y, 0);
+	bool useBuffer = rgb32 || rgb16 || yuv;
+	if ((pitch != stride || outScale) && !yuv) {
+		if (!rgb32 && !rgb16)
+			rgb_buffer.resize(stride*Y, 0);
 		useBuffer = true;
 	}
 	
 	crashed = false;
+	int ret;
 	if (useBuffer) {
-		int ret = pSC->DecompressFrame(pSrc, srcLength, &rgb_buffer[0], ftype);
+		ret = pSC->DecompressFrame(pSrc, srcLength, &rgb_buffer[0], ftype);
+		CTraceScope tsConv("convert out");
+		if (yuv) 
+			UnpackYUV(pDst);
+		else
+		if (outScale)
+			DownscaleOut(pDst, pitch);
+		else
 		if (bpp == 4) {
 			const int stride24 = (X * 3 + 3) & (~3);
 			for(uint y=0;y<Y; y++) {
@@ -1718,7 +2756,7 @@ int ScreenCodec::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int pitc
 					pDst[i]   = rgb_buffer[j];
 					pDst[i+1] = rgb_buffer[j+1];
 					pDst[i+2] = rgb_buffer[j+2];
-					pDst[i+3] = 255;
+					pDst[i+3] = pAlpha ? alpha_buffer[j] : 255;
 					i+=4, j+=3;
 				}
 			}
@@ -1736,8 +2774,354 @@ int ScreenCodec::DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int pitc
 			for(uint y=0;y<Y;y++)
 				memcpy(&pDst[y*pitch], &rgb_buffer[y*stride], X*bpp);
 		}
-		return ret;
+	} else
+		ret = pSC->DecompressFrame(pSrc, srcLength, pDst, ftype);
+	if (trackUsage)
+		FrameUsageDone();
+	return ret;
+}
+
+//one sweep over the frame: each rgb_buffer row is filled from its Y row and chroma row,
+//4:2:0 chroma is repeated for both pixels of a pair and both rows of a pair
+void ScreenCodec::PackYUV(const BYTE *pSrc)
+{
+	const int stride24 = (X * 3 + 3) & (~3);
+	const BYTE *pY = pSrc, *pC1 = pSrc + X*Y;
+	if (yuv==SC_YUV_444P) {
+		const BYTE *pC2 = pC1 + X*Y;
+		for(uint y=0;y<Y;y++) {
+			BYTE *p = &rgb_buffer[y*stride24];
+			const uint i0 = y*X;
+			for(uint x=0;x<X;x++) {
+				p[0] = pY[i0+x]; p[1] = pC1[i0+x]; p[2] = pC2[i0+x];
+				p += 3;
+			}
+		}
 	} else {
-		return pSC->DecompressFrame(pSrc, srcLength, pDst, ftype);
+		const int cw = X / 2;
+		const BYTE *pC2 = pC1 + cw * (Y/2);
+		for(uint y=0;y<Y;y++) {
+			BYTE *p = &rgb_buffer[y*stride24];
+			const BYTE *py = pY + y*X;
+			if (yuv==SC_YUV_NV12) {
+				const BYTE *pc = pC1 + (y/2)*X;
+				for(uint x=0;x<X;x++) {
+					p[0] = py[x]; p[1] = pc[x & ~1]; p[2] = pc[x | 1];
+					p += 3;
+				}
+			} else {
+				const BYTE *pu = pC1 + (y/2)*cw, *pv = pC2 + (y/2)*cw;
+				for(uint x=0;x<X;x++) {
+					p[0] = py[x]; p[1] = pu[x/2]; p[2] = pv[x/2];
+					p += 3;
+				}
+			}
+		}
+	}
+}
+
+void ScreenCodec::UnpackYUV(BYTE *pDst)
+{
+	const int stride24 = (X * 3 + 3) & (~3);
+	BYTE *pY = pDst, *pC1 = pDst + X*Y;
+	if (yuv==SC_YUV_444P) {
+		BYTE *pC2 = pC1 + X*Y;
+		for(uint y=0;y<Y;y++) {
+			const BYTE *p = &rgb_buffer[y*stride24];
+			const uint i0 = y*X;
+			for(uint x=0;x<X;x++) {
+				pY[i0+x] = p[0]; pC1[i0+x] = p[1]; pC2[i0+x] = p[2];
+				p += 3;
+			}
+		}
+		return;
+	}
+	const int cw = X / 2;
+	BYTE *pC2 = pC1 + cw * (Y/2);
+	for(uint y=0;y<Y;y++) {
+		const BYTE *p = &rgb_buffer[y*stride24];
+		BYTE *py = pY + y*X;
+		for(uint x=0;x<X;x++)
+			py[x] = p[x*3];
+		if (y & 1) continue; //chroma taken from even rows
+		if (yuv==SC_YUV_NV12) {
+			BYTE *pc = pC1 + (y/2)*X;
+			for(uint x=0;x+1<X;x+=2) {
+				pc[x] = p[x*3+1]; pc[x+1] = p[x*3+2];
+			}
+		} else {
+			BYTE *pu = pC1 + (y/2)*cw, *pv = pC2 + (y/2)*cw;
+			for(int x=0;x<cw;x++) {
+				pu[x] = p[x*6+1]; pv[x] = p[x*6+2];
+			}
+		}
+	}
+}
+
+void ScreenCodec::EnableBitStats(bool on)
+{
+	collectStats = on;
+	frameStats.Clear(); totalStats.Clear(); alphaStats.Clear();
+	if (pSC) pSC->SetBitStats(on ? &frameStats : NULL);
+	if (pAlpha) pAlpha->SetBitStats(on ? &alphaStats : NULL);
+}
+
+void ScreenCodec::TrackContextUsage(bool on)
+{
+	trackUsage = on;
+	usageSummary.Clear();
+	if (pSC) pSC->CountContextUsage(on);
+	if (pAlpha) pAlpha->CountContextUsage(on);
+}
+
+void ScreenCodec::GetContextUsage(ContextUsage &u)
+{
+	u.Clear();
+	u.codecBytes = sizeof(ScreenCodec);
+	u.bufferBytes = rgb_buffer.capacity() + alpha_buffer.capacity() + rowSums.capacity() * sizeof(uint);
+	if (pSC) pSC->GetContextUsage(u);
+	if (pAlpha) pAlpha->GetContextUsage(u);
+	u.frames = 1;
+}
+
+//models only grow between I-frames, so the state after a frame is its peak
+void ScreenCodec::FrameUsageDone()
+{
+	ContextUsage u;
+	GetContextUsage(u);
+	usageSummary.Accumulate(u);
+}
+
+void ScreenCodec::SetOutputScale(int shift)
+{
+	outScale = yuv ? 0 : min(max(shift, 0), 3);
+}
+
+//average each n x n square of the decoded frame into one output pixel, one pass over rgb_buffer.
+//The full frame is still reconstructed, it's the reference for next P-frames.
+void ScreenCodec::DownscaleOut(BYTE *pDst, int pitch)
+{
+	const int n = 1 << outScale, n2shift = outScale * 2;
+	const int Xo = X >> outScale, Yo = Y >> outScale;
+	const int stride24 = (X * 3 + 3) & (~3);
+	const int nch = pAlpha && bpp==4 ? 4 : 3;
+	rowSums.resize(Xo * 4);
+	for(int yo=0; yo<Yo; yo++) {
+		memset(&rowSums[0], 0, Xo * 4 * sizeof(uint));
+		for(int y=yo*n; y<yo*n+n; y++) {
+			const BYTE *p = &rgb_buffer[y*stride24];
+			const BYTE *pa = nch==4 ? &alpha_buffer[y*stride24] : NULL;
+			for(int xo=0; xo<Xo; xo++) {
+				uint *s = &rowSums[xo*4];
+				for(int k=0; k<n; k++) {
+					s[0] += p[0]; s[1] += p[1]; s[2] += p[2];
+					if (pa) { s[3] += pa[0]; pa += 3; }
+					p += 3;
+				}
+			}
+		}
+		BYTE *q = pDst + yo * pitch;
+		const uint *s = &rowSums[0];
+		for(int xo=0; xo<Xo; xo++, s+=4) {
+			const uint r = s[0] >> n2shift, g = s[1] >> n2shift, b = s[2] >> n2shift;
+			if (bpp==4) {
+				q[0] = r; q[1] = g; q[2] = b; q[3] = nch==4 ? s[3] >> n2shift : 255;
+				q += 4;
+			} else
+			if (bpp==2) {
+				*((WORD*)q) = (r<<redshift) + (g<<greenshift) + (b<<blueshift);
+				q += 2;
+			} else {
+				q[0] = r; q[1] = g; q[2] = b;
+				q += 3;
+			}
+		}
+	}
+}
+
+void ScreenCodec::SetViewport(int x, int y, int w, int h)
+{
+	viewport.x1 = x; viewport.y1 = y; 
+	viewport.x2 = x + w; viewport.y2 = y + h;
+	if (pSC)
+		pSC->SetViewport(viewport);
+}
+
+//alpha changes are added as separate rectangles, they may overlap the rgb ones
+void ScreenCodec::GetChangedRects(std::vector<FrameRect> &rects)
+{
+	rects.clear();
+	if (!pSC) return;
+	pSC->GetChangedRects(rects);
+	if (pAlpha) {
+		std::vector<FrameRect> ar;
+		pAlpha->GetChangedRects(ar);
+		rects.insert(rects.end(), ar.begin(), ar.end());
+	}
+	if (outScale) { //cover every output pixel touched
+		const int n = (1 << outScale) - 1;
+		size_t k = 0;
+		for(size_t i=0;i<rects.size();i++) {
+			FrameRect r = rects[i];
+			r.x1 >>= outScale; r.y1 >>= outScale;
+			r.x2 = min((r.x2 + n) >> outScale, (int)X >> outScale);
+			r.y2 = min((r.y2 + n) >> outScale, (int)Y >> outScale);
+			if (r.x1 < r.x2 && r.y1 < r.y2) //not only in the dropped edge
+				rects[k++] = r;
+		}
+		rects.resize(k);
+	}
+}
+
+void ScreenCodec::GetStaleRects(std::vector<FrameRect> &rects)
+{
+	if (pSC)
+		pSC->GetStaleRects(rects);
+	else
+		rects.clear();
+}
+
+///////////////////////////////////////////////////////////////////////
+
+void BitStats::Add(const BitStats &s)
+{
+	for(int ch=0; ch<3; ch++) {
+		for(int k=0; k<8; k++)
+			color[ch][k] += s.color[ch][k];
+		bypass[ch] += s.bypass[ch];
+	}
+	ptype += s.ptype;
+	runs += s.runs;
+	blocktypes += s.blocktypes;
+	blockruns += s.blockruns;
+	sxy += s.sxy;
+	mv += s.mv;
+	flags += s.flags;
+	xx += s.xx;
+	symbols += s.symbols;
+	frames += s.frames;
+}
+
+double BitStats::Total() const
+{
+	double t = ptype + runs + blocktypes + blockruns + sxy + mv + flags + xx;
+	for(int ch=0; ch<3; ch++) {
+		for(int k=0; k<8; k++)
+			t += color[ch][k];
+		t += bypass[ch];
+	}
+	return t;
+}
+
+void BitStats::Print(FILE *f, double bytes) const
+{
+	const double total = Total();
+	if (total <= 0) return;
+	const char *chn[3] = { "c0", "c1", "c2" };
+	fprintf(f, "frames %u, symbols %u, coded %.0f bytes, headers %.0f bytes\n", frames, symbols, total / 8, bytes - total / 8);
+	#define SC_BITS_LINE(name, v) if (v > 0) fprintf(f, "  %-14s %12.0f bytes %6.2f%%\n", name, v / 8, v * 100 / total)
+	for(int ch=0; ch<3; ch++) {
+		char name[32];
+		for(int k=0; k<8; k++) {
+			sprintf(name, "%s Cx%d", chn[ch], k);
+			SC_BITS_LINE(name, color[ch][k]);
+		}
+		sprintf(name, "%s bypass", chn[ch]);
+		SC_BITS_LINE(name, bypass[ch]);
+	}
+	SC_BITS_LINE("pixel types", ptype);
+	SC_BITS_LINE("pixel runs", runs);
+	SC_BITS_LINE("block types", blocktypes);
+	SC_BITS_LINE("block runs", blockruns);
+	SC_BITS_LINE("block bounds", sxy);
+	SC_BITS_LINE("motion vectors", mv);
+	SC_BITS_LINE("MV flags", flags);
+	SC_BITS_LINE("block indices", xx);
+	#undef SC_BITS_LINE
+}
+
+void ContextUsage::Add(const ContextUsage &u)
+{
+	for(int k=0; k<8; k++) {
+		kinds[k] += u.kinds[k];
+		upgrades[k] += u.upgrades[k];
+	}
+	contextBytes += u.contextBytes;
+	codecBytes += u.codecBytes;
+	bufferBytes += u.bufferBytes;
+	symbols += u.symbols;
+	bypassed += u.bypassed;
+	frames += u.frames;
+}
+
+void ContextUsage::Accumulate(const ContextUsage &u)
+{
+	if (u.Bytes() > Bytes()) {
+		memcpy(kinds, u.kinds, sizeof(kinds));
+		contextBytes = u.contextBytes;
+		codecBytes = u.codecBytes;
+		bufferBytes = u.bufferBytes;
+	}
+	for(int k=0; k<8; k++)
+		upgrades[k] += u.upgrades[k];
+	symbols += u.symbols;
+	bypassed += u.bypassed;
+	frames += u.frames;
+}
+
+void ContextUsage::Print(FILE *f) const
+{
+	uint n = 0;
+	for(int k=0; k<8; k++)
+		n += kinds[k];
+	fprintf(f, "memory %.1f KB: contexts %.1f KB, codec objects %.1f KB, buffers %.1f KB\n", 
+		Bytes() / 1024.0, contextBytes / 1024.0, codecBytes / 1024.0, bufferBytes / 1024.0);
+	fprintf(f, "color contexts %u:", n);
+	for(int k=0; k<8; k++)
+		if (kinds[k]) fprintf(f, " Cx%d %u (%.1f%%)", k, kinds[k], kinds[k] * 100.0 / n);
+	fprintf(f, "\n");
+	if (frames == 0 || symbols == 0) return;
+	fprintf(f, "per frame over %u frames: upgrades", frames);
+	for(int k=1; k<8; k++)
+		fprintf(f, " Cx%d %.1f", k, (double)upgrades[k] / frames);
+	fprintf(f, ", color symbols %.0f, raw bytes %.2f%%\n", (double)symbols / frames, bypassed * 100.0 / symbols);
+}
+
+///////////////////////////////////////////////////////////////////////
+
+void RateControl::Init(uint bytes_per_sec, uint rate, uint scale)
+{
+	if (rate==0 || scale==0) { rate = 25; scale = 1; } //frame rate unknown
+	budget = (int)((__int64)bytes_per_sec * scale / rate);
+	capacity = bytes_per_sec;
+	holdFrames = max(rate / scale / 2, 1);
+	bucket = 0; loss = 0; hold = 0;
+}
+
+//changing loss makes every pixel differ from previous frame, so it's changed
+//in single steps with a pause after each, and lowered only when the bucket is almost empty.
+//A frame that fills the bucket over capacity raises loss at once, P-frames are dropped
+//and forced key frames wait until it drains (see Overflow), so a second of stream stays
+//under 2*capacity plus one frame unless the host asks for key frames meanwhile
+void RateControl::FrameDone(int size)
+{
+	if (!Enabled()) return;
+	bucket = max(bucket + size - budget, 0);
+	if (bucket > capacity && size > budget) {
+		if (loss < 4) loss++;
+		hold = holdFrames;
+		return;
+	}
+	if (hold > 0) {
+		hold--;
+		return;
+	}
+	if (bucket > capacity / 2 && loss < 4) {
+		loss++;
+		hold = holdFrames;
+	} else
+	if (bucket < capacity / 8 && loss > 0) {
+		loss--;
+		hold = holdFrames;
 	}
 }
@@ -13,6 +13,7 @@
 #define SCREENCAPH
 
 #include <vector>
+#include <math.h>
 #include "squad.h"
 #include "sub.h"
 #include "logging.h"
@@ -44,20 +45,78 @@
 #define SC_UNSTEP 1000 
 #define SC_XXSTEP 1
 
+// Lower 4 bits of the first byte of an I-frame: 1 - flat frame, 2 - normal frame,
+// SC_TILED - frame made of independently coded tiles, SC_STATIC_I - see CompressIStatic.
+#define SC_TILED 3
+#define SC_STATIC_I 4
+#define SC_MAXTILE (255*16)
+// Flag in the same bits: frame of RGBA stream, [rgb frame][alpha frame][4 bytes LE rgb frame size].
+// Alpha is coded as a separate RGB24 frame with pixels (A,A,A).
+#define SC_ALPHA 8
+
+//Static models of SC_STATIC_I frames: ptype after each ptype, runs of each ptype from SC_STAB_N,
+//colors of each channel in context of previous channel >> SC_SCXSHIFT from SC_STAB_C
+#define SC_SCXSHIFT 3
+#define SC_SCXMAX (256 >> SC_SCXSHIFT)
+#define SC_STAB_N 6
+#define SC_STAB_C (SC_STAB_N + SC_NCXMAX)
+#define SC_STABS (SC_STAB_C + 3*SC_SCXMAX)
+
+//planar YUV layouts accepted by ScreenCodec, coded as 24-bit pixels (Y, plane 1, plane 2)
+//with chroma repeated over its 2x2 square, so 4:2:0 data comes back exactly
+#define SC_YUV_420P 1 // I420, IYUV, YV12: Y plane, two quarter-size chroma planes
+#define SC_YUV_NV12 2 // Y plane, one quarter-size plane of interleaved U,V
+#define SC_YUV_444P 3 // YV24: three full planes
+
+//P-frame is coded as I-frame when at least SC_KF_CHANGED % of blocks changed
+//and less than SC_KF_MVFOUND % of them were found by motion search
+#define SC_KF_CHANGED 90
+#define SC_KF_MVFOUND 5
+
+//Frames wider or taller than this need bitstream version 5 or later, where
+//changed block indices take 3 bytes when there are more than 65536 blocks
+//and motion vectors beyond +-255 are escaped.
+#define SC_V4_MAXSIZE 2048
+
+//Newest bitstream version, ScreenCodec decodes versions 2 up to this one.
+//It writes v4 (v5 for frames beyond SC_V4_MAXSIZE) unless v6 is asked for.
+//v6 is v5 with PROB_BITS_FX precision of runs, pixel types, block data and MVs
+//and bypassed color bytes stored after rANS data of each block.
+#define SC_VERSION 6
+
+//encoder speed presets, see SetSpeedPreset()
+#define SC_PRESET_ULTRAFAST 0
+#define SC_PRESET_FAST 1
+#define SC_PRESET_DEFAULT 2
+#define SC_PRESET_MAX 3
+
 //#define TIMING
 
 struct CodecParameters {
 	uint width, height; //image size
 	BYTE bits_per_pixel; //16, 24 or 32
 	WORD redmask, greenmask, bluemask; // color masks for 16 bit mode, like 0x7C00, 0x3E0, 0x1F
-	uint high_range_x, high_range_y, low_range_x, low_range_y; //motion search range, like 256,256, 8,8
+	uint high_range_x, high_range_y, low_range_x, low_range_y; //motion search range, like 256,256, 8,8; high range 0 = no line scans
 	uint loss; // in bits (0..5)
+	uint threads; // number of worker threads, 0 = one per CPU
+	uint tile_size; // 0 = whole frame at once, otherwise side of a square tile in pixels, multiple of 16
+	uint adaptive_loss; // 1 = apply loss only to blocks looking like photos, keep text and UI lossless
+	uint alpha; // 1 = keep alpha channel of RGB32 input, lossless
+	uint yuv; // SC_YUV_* layout of input/output, 0 = RGB
+	uint static_iframes; // 1 = I-frames in independent bands with static models (v6+), coded in parallel
+	uint bitstream_v6; // 1 = write bitstream v6, older codecs can't decode it
+};
+
+//rectangle in frame buffer coordinates, x2 and y2 not included
+struct FrameRect {
+	int x1, y1, x2, y2;
 };
 
 //bounds of changed blocks in a part of frame processed by one worker
 struct BlockRegion {
 	int bx1, bx2, by1, by2;
-	BlockRegion() : bx1(-1), bx2(-1), by1(-1), by2(-1) {};
+	int changed, mvfound; //number of changed blocks and how many of them were found by motion search
+	BlockRegion() : bx1(-1), bx2(-1), by1(-1), by2(-1), changed(0), mvfound(0) {};
 };
 
 struct DecideBlocksParams {
@@ -79,16 +138,89 @@ struct PrevCmpParams {
 	}
 };
 
+struct StaticIParams { //SC_STATIC_I frame being decoded
+	BYTE *pDst;
+	std::vector<BYTE*> data; //coded bands
+	std::vector<int> y0, rows;
+};
+
 struct WorkerData { // thread-local data for worker threads
-	int rleStartPos, rleSize; // slice in rleData
+	std::vector<BYTE> runs; // pixel runs of a band as varints (n<<3 | ptype), storage kept between frames
+	std::vector<uint> counts; // symbols of SC_STATIC_I band, 256 for each of SC_STABS models
+	std::vector<Freq> ranges; // SC_STATIC_I band: intervals waiting for rANS
+	std::vector<BYTE> coded; // SC_STATIC_I band: rANS output
+	int y0, rows; // SC_STATIC_I band of this worker
+
+	WorkerData() : y0(0), rows(0) {}
+
+	void AddRun(int ptype, int n) // n <= 255, so 1 or 2 bytes
+	{
+		const uint v = (n << 3) | ptype;
+		if (v < 128)
+			runs.push_back(v);
+		else {
+			runs.push_back((v & 127) | 128);
+			runs.push_back(v >> 7);
+		}
+	}
 };
 
+//read a run written by WorkerData::AddRun, advance j
+inline void GetRun(const BYTE *runs, int &j, int &ptype, int &n)
+{
+	uint v = runs[j++];
+	if (v & 128)
+		v = (v & 127) | (runs[j++] << 7);
+	ptype = v & 7; n = v >> 3;
+}
+
 class BadVersionException {
 public:
 	BadVersionException(int v) : version(v) { }
 	int version;
 };
 
+//where encoded bits go, collected by ANS encoder (v3+) when it has a pointer to this.
+//Bits of a symbol are log2(coded scale / freq) of its interval, 8 for a bypassed byte.
+struct BitStats {
+	double color[3][8]; //per channel, by context kind before coding (0 = new context, 1..7 = Cx1..Cx7)
+	double bypass[3]; //raw color bytes per channel
+	double ptype; //pixel types
+	double runs; //run lengths in ntab[ptype]
+	double blocktypes, blockruns; //bttab, ntab2
+	double sxy; //changed area bounds inside blocks
+	double mv; //motion vectors
+	double flags; //bits coded with P=1/2: MV same-as-last flags, escaped long MVs
+	double xx; //first and last changed block indices
+	uint symbols, frames;
+
+	BitStats() { Clear(); }
+	void Clear() { memset(this, 0, sizeof(BitStats)); }
+	void Add(const BitStats &s);
+	double Total() const;
+	void Print(FILE *f, double bytes) const; //bytes: actual compressed size, difference is headers
+};
+
+//what statistical models of a codec instance look like and how much memory they hold,
+//for sizing memory budgets. Heap sizes are requested sizes, allocator overhead not included.
+struct ContextUsage {
+	uint kinds[8]; //color contexts by kind: 0 = not met yet, 1..7 = Cx1..Cx7; v2 tables are all 0
+	size_t contextBytes; //heap held by color contexts and allocated RLE/MV tables
+	size_t codecBytes; //codec objects themselves, fixed size tables live there
+	size_t bufferBytes; //previous frame, block data, pixel runs, conversion buffers
+	//counted per frame when enabled, v3+ only:
+	uint upgrades[8]; //color contexts that became kind 1..7 (1 = first use)
+	uint symbols, bypassed; //color symbols and those stored as raw bytes
+	uint frames;
+
+	ContextUsage() { Clear(); }
+	void Clear() { memset(this, 0, sizeof(ContextUsage)); }
+	size_t Bytes() const { return contextBytes + codecBytes + bufferBytes; }
+	void Add(const ContextUsage &u); //another instance at the same moment: everything summed
+	void Accumulate(const ContextUsage &u); //later frame: counters summed, memory of the larger snapshot kept
+	void Print(FILE *f) const;
+};
+
 //common interface for different versions of the codec
 class IScreenCapt {
 public:
@@ -99,8 +231,17 @@ public:
 	virtual ~IScreenCapt() {};
 	virtual void SetupLossMask(int loss)=0;
 	virtual void setCx6f0(int f0)=0;
+	virtual void SetViewport(const FrameRect &rc) {} //decoder may skip parts of frame outside the viewport
+	virtual void GetStaleRects(std::vector<FrameRect> &rects) { rects.clear(); } //skipped parts of last decoded frame
+	virtual void GetChangedRects(std::vector<FrameRect> &rects)=0; //parts of last decoded frame that may differ from the one before
+	virtual void SetBitStats(BitStats *pStats) {} //encoder adds bits it spends to *pStats, NULL = off
+	virtual void CountContextUsage(bool on) {} //count context upgrades and raw bytes in each frame
+	virtual void GetContextUsage(ContextUsage &u) {} //add models held now and counters of last frame to u
 };
 
+IScreenCapt* CreateScreenCapt(int version); //RGB24 codec of given bitstream version
+void SetSpeedPreset(CodecParameters *pParams, int preset); //fill motion search ranges for SC_PRESET_*
+
 // strategy for using range coder and its tables, this is compatible with v2
 struct UseRC {
 	BYTE *pDst; // when decoding pDst is used as pSrc
@@ -129,6 +270,12 @@ struct UseRC {
 	int vmAction() { return 2; 	} //write 2 zeroes (64 bits in total)
 #endif
 	void setMotionRange(uint msrX, uint msrY) { msr_x = msrX; msr_y = msrY; }
+	void setStats(BitStats *p) {} //no bit accounting for v2
+	void setCounts(ContextUsage *p) {}
+	size_t heapBytesNM() const { //allocated RLE and MV tables
+		return (SC_NCXMAX * SUB_TABLE_SIZE(256) + SUB_TABLE_SIZE(msr_x * 2) + SUB_TABLE_SIZE(msr_y * 2)) * sizeof(uint);
+	}
+	size_t heapBytesBuf() const { return 0; } //coder buffers
 
 	void stop() {}
 
@@ -142,23 +289,17 @@ struct UseRC {
 		pDst = rc.DecodeVal(n, ntab, ntab[256], 256, SC_NSTEP, pDst);
 		return n;
 	}
-	CtxN createN() { return (uint*)calloc(257,  sizeof(uint)); }
+	CtxN createN() { return (uint*)calloc(SUB_TABLE_SIZE(256),  sizeof(uint)); }
 	void freeN(CtxN &ntab) { free(ntab); }
-	void renewN(CtxN &ntab) {
-		for(int i=0;i<256;i++) ntab[i] = 1;
-		ntab[256] = 256;
-	}
+	void renewN(CtxN &ntab) { RangeCoderSub::RenewVal(ntab, 256); }
 
-	template<int L> struct FixedTab {
-		uint tab[L];
+	template<int N> struct FixedTab { //N values, total in tab[N]
+		uint tab[SUB_TABLE_SIZE(N)];
 
-		void renew() {
-			for(int i=0;i<L-1;i++) tab[i] = 1;
-			tab[L-1] = L-1;
-		}
+		void renew() { RangeCoderSub::RenewVal(tab, N); }
 	};
 
-	typedef FixedTab<7> CtxP;
+	typedef FixedTab<6> CtxP;
 	void encodeP(int ptype, CtxP& ptab) {
 		pDst = rc.EncodeVal(ptype, ptab.tab, ptab.tab[6], 6, SC_UNSTEP, pDst);
 	}
@@ -171,24 +312,20 @@ struct UseRC {
 
 	typedef uint* CtxC; //color: r, g or b
 	void encodeC(int c, CtxC& cntab) {
-		pDst = rc.EncodeValUni(c, cntab, cntab[256+16], SC_STEP, pDst);
+		pDst = rc.EncodeVal(c, cntab, cntab[256], 256, SC_STEP, pDst);
 	}
 	int decodeC(CtxC& cntab) {
 		int c;
-		pDst = rc.DecodeValUni(c, cntab, cntab[256+16], SC_STEP, pDst);
+		pDst = rc.DecodeVal(c, cntab, cntab[256], 256, SC_STEP, pDst);
 		return c;
 	}
-	CtxC createC() { return (uint*)calloc(256+16+1, sizeof(uint)); }
+	CtxC createC() { return (uint*)calloc(SUB_TABLE_SIZE(256), sizeof(uint)); }
 	void freeC(CtxC &cntab) { free(cntab); }
-	void renewC(CtxC &cntab) {
-		for(int n=0;n<256;n++)
-			cntab[n] = 1;
-		for(int n=0;n<16;n++)
-			cntab[256+n] = 16;
-		cntab[256+16] = 256;//totfr
-	}
+	int kindC(CtxC &cntab) const { return 0; }
+	size_t heapBytesC(CtxC &cntab) const { return cntab ? SUB_TABLE_SIZE(256) * sizeof(uint) : 0; }
+	void renewC(CtxC &cntab) { RangeCoderSub::RenewVal(cntab, 256); }
 
-	typedef FixedTab<257> CtxX;
+	typedef FixedTab<256> CtxX;
 	void encodeX(int xx, CtxX& xxtab) {
 		pDst = rc.EncodeVal(xx, xxtab.tab, xxtab.tab[256], 256, SC_XXSTEP,pDst);
 	}
@@ -199,7 +336,7 @@ struct UseRC {
 	}
 	void renewX(CtxX &xxtab) { xxtab.renew(); }
 
-	typedef FixedTab<257> CtxBN;
+	typedef FixedTab<256> CtxBN;
 	void encodeBN(int n, CtxBN& ntab2) {
 		pDst = rc.EncodeVal(n, ntab2.tab, ntab2.tab[256], 256, SC_BTNSTEP, pDst);
 	}
@@ -210,7 +347,7 @@ struct UseRC {
 	}
 	void renewBN(CtxBN &ntab2) { ntab2.renew(); }
 
-	typedef FixedTab<6> CtxBT;
+	typedef FixedTab<5> CtxBT;
 	void encodeBT(int bt, CtxBT& bttab) {
 		pDst = rc.EncodeVal(bt, bttab.tab, bttab.tab[5], 5, SC_BTSTEP, pDst);
 	}
@@ -221,7 +358,7 @@ struct UseRC {
 	}
 	void renewBT(CtxBT& bttab) { bttab.renew(); }
 
-	typedef FixedTab<17> CtxSXY;
+	typedef FixedTab<16> CtxSXY;
 	void encodeSXY(int x, CtxSXY& sxytab) {
 		pDst = rc.EncodeVal(x, sxytab.tab, sxytab.tab[16], 16, SC_SXYSTEP, pDst);
 	}
@@ -250,14 +387,10 @@ struct UseRC {
 		pDst = rc.DecodeVal(x, mvtab, mvtab[msr_y*2], msr_y*2, SC_MSTEP, pDst);
 		return x;
 	}
-	CtxM createMX() { return (uint*) calloc((msr_x * 2 + 1) , sizeof(uint)); }
-	CtxM createMY() { return (uint*) calloc((msr_y * 2 + 1) , sizeof(uint)); }
+	CtxM createMX() { return (uint*) calloc(SUB_TABLE_SIZE(msr_x * 2), sizeof(uint)); }
+	CtxM createMY() { return (uint*) calloc(SUB_TABLE_SIZE(msr_y * 2), sizeof(uint)); }
 	void freeM(CtxM &mvtab) { free(mvtab); }
-	void renewM(CtxM &mvtab, bool xdimension) {
-		const int mx = xdimension ? msr_x*2 : msr_y*2;
-		for(int i=0;i<mx;i++) mvtab[i] = 1;
-		mvtab[mx] = mx;
-	}
+	void renewM(CtxM &mvtab, bool xdimension) { RangeCoderSub::RenewVal(mvtab, xdimension ? msr_x*2 : msr_y*2); }
 
 	static const bool canEncodeBool = false;
 	void encodeBool(bool flag) { }
@@ -266,16 +399,43 @@ struct UseRC {
 
 extern void SetThreadLocalInt(int v);
 
-//strategy for using ANS entropy coder and context tables, this is v3
-struct UseANS {
+//strategy for using ANS entropy coder and context tables, this is v3.
+//Bits is precision of fixed-size contexts and of coded intervals: PROB_BITS in v3-v5,
+//PROB_BITS_FX in v6, where colour contexts keep PROB_BITS and their intervals are scaled up.
+//v6 also keeps bypassed color bytes apart from rANS data, see RansMTCoder.
+template<int Bits>
+struct UseANSBits {
 	BYTE *pDst; // when decoding pDst is used as pSrc
+	BYTE *pRaw; //bypassed bytes of current block when decoding v6
 	RansMTCoder rmtc;
 	RansState ransDec; //for decoding
 	int nDec;
 	bool decoding;
 	int f0val; // for Cx6
+	BitStats *stats; //when not NULL, encoded bits are accounted here
+	int statChannel; //channel of next color, they always go in r,g,b order
+	ContextUsage *counts; //when not NULL, color context upgrades and raw bytes are counted here
 
-	UseANS() : decoding(true) {} //init just in case we call renew before decodeBegin
+	static const int cshift = Bits - PROB_BITS; //colour intervals to coded ones
+	static const bool rawApart = Bits > PROB_BITS; //v6
+
+	UseANSBits() : decoding(true), stats(NULL), statChannel(0), counts(NULL) { //init just in case we call renew before decodeBegin
+		rmtc.scaleBits = Bits;
+		rmtc.rawApart = rawApart;
+	}
+	void setStats(BitStats *p) { stats = p; }
+	void setCounts(ContextUsage *p) { counts = p; }
+	void countC(int oldKind, const Context &cntab, bool bypass) {
+		counts->symbols++;
+		if (bypass) counts->bypassed++;
+		if (cntab.kind() != oldKind) counts->upgrades[cntab.kind()]++;
+	}
+	size_t heapBytesNM() const { return 0; }
+	size_t heapBytesBuf() const { return rmtc.heapBytes(); } //coder buffers
+	void count(double &where, const Freq &fr) {
+		where += fr.freq ? Bits - log((double)fr.freq) * 1.4426950408889634 : 8; //log2
+		stats->symbols++;
+	}
 
 	void stop() { rmtc.stop(); } //stop the thread
 
@@ -286,6 +446,7 @@ struct UseANS {
 		rmtc.ransInitState = RANS_BYTE_L;
 #endif
 		rmtc.start(pDest);
+		statChannel = 0;
 
 		SetThreadLocalInt(f0val);
 	}
@@ -296,9 +457,24 @@ struct UseANS {
 		pDst = pSrc;
 		decoding = true;
 		nDec = 0;
-		RansDecInit(&ransDec, &pDst);
+		decodeBlock();
 		SetThreadLocalInt(f0val);
 	}
+	void decodeBlock() { //start next rANS block
+		if (rawApart) {
+			pRaw = pDst + 4 + *(uint*)pDst;
+			pDst += 4;
+		}
+		RansDecInit(&ransDec, &pDst);
+	}
+	void beforeDecode() { //after B intervals next one is in next block, started only when needed
+		if (nDec==RansMTCoder::B) { //as the last block may hold exactly B intervals
+			if (rawApart) pDst = pRaw; //all raw bytes of the block are read by now
+			decodeBlock();
+			nDec = 0;
+		}
+	}
+	void decoded() { nDec++; } //one more interval of current block
 
 	#ifndef NOPROTECT
 	void* lowPtr() { return &rmtc.ransInitState; }
@@ -310,93 +486,105 @@ struct UseANS {
 	typedef Context CtxC;
 	void encodeC(int c, CtxC& cntab) {
 		Freq fr;
+		const int kind = cntab.kind();
 		if (!cntab.encode(c, fr)) { //false => bypass
 			fr.freq = 0; fr.cumFreq = c;
-		} 
-		rmtc.put(fr);
+		} else if (cshift) {
+			fr.cumFreq <<= cshift; fr.freq <<= cshift;
+		}
+		if (stats) {
+			count(fr.freq ? stats->color[statChannel][kind] : stats->bypass[statChannel], fr);
+			statChannel = statChannel==2 ? 0 : statChannel + 1;
+		}
+		if (counts) countC(kind, cntab, fr.freq==0);
+		if (rawApart && fr.freq==0)
+			rmtc.putRaw(c);
+		else
+			rmtc.put(fr);
 	}
 	int decodeC(CtxC& cntab) {
 		Freq fr;
 		BYTE c;
-		if (cntab.decode( RansDecGet(&ransDec, PROB_BITS), c, fr))  {
-			RansDecAdvance(&ransDec, &pDst, fr.cumFreq, fr.freq, PROB_BITS);
+		const int kind = cntab.kind();
+		bool bypass = false;
+		beforeDecode();
+		if (cntab.decode( RansDecGet(&ransDec, Bits) >> cshift, c, fr))  {
+			RansDecAdvance(&ransDec, &pDst, fr.cumFreq << cshift, fr.freq << cshift, Bits);
 		} else {
-			c = *pDst++;
+			c = rawApart ? *pRaw++ : *pDst++;
 			cntab.update(c);
+			bypass = true;
 		}		
-		nDec++;
-		if (nDec==RansMTCoder::B) {
-			RansDecInit(&ransDec, &pDst);
-			nDec = 0;
-		}
+		if (counts) countC(kind, cntab, bypass);
+		if (!(rawApart && bypass)) decoded(); //raw bytes kept apart are not in rANS block
 		return c;
 	}
 
 	CtxC createC() { Context c; return c; }	
 	void freeC(CtxC &cntab) { cntab.free(); }
 	void renewC(CtxC &cntab) { cntab.renew(); }
+	int kindC(CtxC &cntab) const { return cntab.kind(); }
+	size_t heapBytesC(CtxC &cntab) const { return cntab.heapBytes(); }
 
 	template<int NSym>
-	void encodeF(int n, FixedSizeRansCtx<NSym> &cx) {
+	void encodeF(int n, FixedSizeRansCtx<NSym, Bits> &cx, double BitStats::*what) {
 		Freq fr;
 		cx.encode(n, fr);
+		if (stats) count(stats->*what, fr);
 		rmtc.put(fr);
 	}
 
 	template<int NSym>
-	int decodeF(FixedSizeRansCtx<NSym> &cx) {
+	int decodeF(FixedSizeRansCtx<NSym, Bits> &cx) {
 		Freq fr; 
-		int c = cx.decode(RansDecGet(&ransDec, PROB_BITS), fr);
+		beforeDecode();
+		int c = cx.decode(RansDecGet(&ransDec, Bits), fr);
 		assert(c >= 0);
 		assert(c < NSym);
-		RansDecAdvance(&ransDec, &pDst, fr.cumFreq, fr.freq, PROB_BITS);
-		nDec++;
-		if (nDec==RansMTCoder::B) {
-			RansDecInit(&ransDec, &pDst);
-			nDec = 0;
-		}
+		RansDecAdvance(&ransDec, &pDst, fr.cumFreq, fr.freq, Bits);
+		decoded();
 		return c;
 	}
 
-	typedef FixedSizeRansCtx<256> CtxN;
+	typedef FixedSizeRansCtx<256, Bits> CtxN;
 	static const bool CtxNalloc = false; //need to call createN?
 
-	void encodeN(int n, CtxN &ntab) { encodeF(n, ntab);	}
+	void encodeN(int n, CtxN &ntab) { encodeF(n, ntab, &BitStats::runs);	}
 	int decodeN(CtxN& ntab) { return decodeF(ntab); }
 	CtxN createN() { CtxN c; assert(0 && "should not be called"); return c; }
 	void freeN(CtxN &ntab) {}
 	void renewN(CtxN &ntab) { ntab.renew(decoding); }
 	
-	typedef FixedSizeRansCtx<6> CtxP;
-	void encodeP(int ptype, CtxP& ptab) { encodeF(ptype, ptab); }
+	typedef FixedSizeRansCtx<6, Bits> CtxP;
+	void encodeP(int ptype, CtxP& ptab) { encodeF(ptype, ptab, &BitStats::ptype); }
 	int decodeP(CtxP& ptab) { return decodeF(ptab); }
 	void renewP(CtxP &ptab) { ptab.renew(decoding); }
 
-	typedef FixedSizeRansCtx<256> CtxX;
-	void encodeX(int xx, CtxX& xxtab) { encodeF(xx, xxtab); }
+	typedef FixedSizeRansCtx<256, Bits> CtxX;
+	void encodeX(int xx, CtxX& xxtab) { encodeF(xx, xxtab, &BitStats::xx); }
 	int decodeX(CtxX& xxtab) { return decodeF(xxtab); }
 	void renewX(CtxX &xxtab) { xxtab.renew(decoding); }
 
-	typedef FixedSizeRansCtx<256> CtxBN;
-	void encodeBN(int n, CtxBN& ntab2) { encodeF(n, ntab2); }
+	typedef FixedSizeRansCtx<256, Bits> CtxBN;
+	void encodeBN(int n, CtxBN& ntab2) { encodeF(n, ntab2, &BitStats::blockruns); }
 	int decodeBN(CtxBN& ntab2) { return decodeF(ntab2); }
 	void renewBN(CtxBN &ntab2) { ntab2.renew(decoding); }
 
-	typedef FixedSizeRansCtx<5> CtxBT;
-	void encodeBT(int bt, CtxBT& bttab) { encodeF(bt, bttab); }
+	typedef FixedSizeRansCtx<5, Bits> CtxBT;
+	void encodeBT(int bt, CtxBT& bttab) { encodeF(bt, bttab, &BitStats::blocktypes); }
 	int decodeBT(CtxBT& bttab) { return decodeF(bttab); }
 	void renewBT(CtxBT& bttab) { bttab.renew(decoding); }
 
-	typedef FixedSizeRansCtx<16> CtxSXY;
-	void encodeSXY(int x, CtxSXY& sxytab) { encodeF(x, sxytab); }
+	typedef FixedSizeRansCtx<16, Bits> CtxSXY;
+	void encodeSXY(int x, CtxSXY& sxytab) { encodeF(x, sxytab, &BitStats::sxy); }
 	int decodeSXY(CtxSXY& sxytab) { return decodeF(sxytab); }
 	void renewSXY(CtxSXY& sxytab) { sxytab.renew(decoding); }
 
 	static const bool CtxMalloc = false; //need to call createMX/MY?
-	typedef FixedSizeRansCtx<512> CtxM;
-	void encodeMX(int x, CtxM& mvtab) { encodeF(x, mvtab); }
+	typedef FixedSizeRansCtx<512, Bits> CtxM;
+	void encodeMX(int x, CtxM& mvtab) { encodeF(x, mvtab, &BitStats::mv); }
 	int decodeMX(CtxM& mvtab) { return decodeF(mvtab); }
-	void encodeMY(int x, CtxM& mvtab) { encodeF(x, mvtab); }
+	void encodeMY(int x, CtxM& mvtab) { encodeF(x, mvtab, &BitStats::mv); }
 	int decodeMY(CtxM& mvtab) { return decodeF(mvtab); }
 	CtxM createMX() { CtxM c; assert(0 && "Should not be called"); return c; }
 	CtxM createMY() { CtxM c; assert(0 && "Should not be called"); return c; }
@@ -405,22 +593,25 @@ struct UseANS {
 
 	static const bool canEncodeBool = true;
 	void encodeBool(bool flag) { // P=0.5
-		Freq fr = { PROB_SCALE/2, (flag ? PROB_SCALE/2 : 0)};
+		const int half = 1 << (Bits-1);
+		Freq fr = { half, (flag ? half : 0)};
+		if (stats) count(stats->flags, fr);
 		rmtc.put(fr);
 	}
 	bool decodeBool() {
-		auto f = RansDecGet(&ransDec, PROB_BITS);
-		bool flag = f >= PROB_SCALE/2;
-		RansDecAdvance(&ransDec, &pDst, (flag ? PROB_SCALE/2 : 0) , PROB_SCALE/2, PROB_BITS);
-		nDec++;
-		if (nDec==RansMTCoder::B) {
-			RansDecInit(&ransDec, &pDst);
-			nDec = 0;
-		}
+		const int half = 1 << (Bits-1);
+		beforeDecode();
+		auto f = RansDecGet(&ransDec, Bits);
+		bool flag = f >= half;
+		RansDecAdvance(&ransDec, &pDst, (flag ? half : 0) , half, Bits);
+		decoded();
 		return flag;
 	}
 };
 
+typedef UseANSBits<PROB_BITS> UseANS; //v3-v5
+typedef UseANSBits<PROB_BITS_FX> UseANS15; //v6
+
 //state of a row of 16x16 blocks during processing, used for work stealing between threads 
 enum RowState { Untouched, Processing, Done };
 
@@ -449,8 +640,13 @@ protected:
 	int *sxy[4]; //sx1, sy1, sx2, sy2 for each block
 	int *mvs[2]; //motion vectors
 	static const uint bytespp = 3; //bytes per pixel: 2 or 3
-	uint msr_x, msr_y, msrlow_x, msrlow_y; //motion search ranges 
+	uint msr_x, msr_y, msrlow_x, msrlow_y; //motion vector ranges (coded) and near search ranges
+	uint srch_x, srch_y; //far search range, not more than mvmax_x, mvmax_y
+	uint mvmax_x, mvmax_y; //longest motion vectors that can be coded
+	int xxBytes; //bytes in changed block indices of P-frame
 	CSquad *pSquad;
+	int nThreads; //0 = one per CPU
+	bool adaptiveLoss; //loss only in natural image blocks
 #ifndef NOPROTECT
 	LVM2 vm;
 #endif
@@ -461,20 +657,31 @@ protected:
 	BYTE *pDstEnd;
 	std::vector<BYTE> saveBuffer;
 	int last_ftype;	
+	bool last_was_static; //last I-frame was SC_STATIC_I, its saved data needs that byte
+	bool allowSceneCut; //P-frame may turn into I-frame when too much has changed
 
 	std::vector<WorkerData> tls; // with work stealing this must have nby entries
-	std::vector<BYTE> rleData;
+	uint scratchBytes, peakScratchBytes; //size of pixel runs in last frame and maximum so far
+	std::vector<FrameRect> changedRects; //changed blocks of last decoded frame, merged into rectangles
+	ContextUsage counts; //context upgrades and raw bytes of last frame, when counting is on
+	bool countUsage;
 
 	CRITICAL_SECTION rowsCritSec;
 	std::vector<RowState> rowStates;
 
 	int myVersion;
+	bool staticI; //I-frames as SC_STATIC_I
+	std::vector<StaticRansCtx> stabs; //models of last SC_STATIC_I frame, SC_STABS of them
 
 #ifdef TIMING
 	LARGE_INTEGER perfreq; //for speed testing
 	std::vector<double> runCmdTimes;
 #endif
 	bool FindMV(BYTE *pSrc, int bi, int &last_mvx, int &last_mvy, int upperBI); //find motion vector
+	void EncodeMV(int mx, int my);
+	void DecodeMV(int &mx, int &my);
+	void EncodeLongMV(int m); //escaped motion vector component, v5
+	int DecodeLongMV();
 	bool SameBlocks(BYTE *pSrc, int i, int ip, int width_bytes, int height);
 	BOOL IsFlat(BYTE *pSrc); //is image filled with one color?
 
@@ -483,9 +690,13 @@ protected:
 	virtual int DecompressI(BYTE *pSrc, int srcLength, BYTE *pDst);
 	virtual int CompressP(BYTE *pSrc, BYTE *pDST);
 	virtual int DecompressP(BYTE *pSrc, int srcLength, BYTE *pDST);
+	int CompressIStatic(BYTE *pSrc, BYTE *pDST);
+	int DecompressIStatic(BYTE *pSrc, int srcLength, BYTE *pDst);
 
 	void RenewI(); //reinit stats for compressing/decompressing I-frame
 	void DoLoss(BYTE *pSrc, PrevCmpParams* pcparams);
+	bool IsNaturalBlock(BYTE *pSrc, int x1, int y1, int x2, int y2); //photo-like content, see adaptive_loss
+	void LossBlockRow(BYTE *pSrc, int by); //adaptive loss for one row of blocks
 
 	//pixel encoding / decoding
 	void EncodeRGB(BYTE *pSrc);
@@ -499,6 +710,19 @@ protected:
 	void WritePixel(int ptype, int lastptype, BYTE* pSrc);
 
 	void ClassifyPixelsI(int myNum, int y0, int ysize, BYTE *pSrc);
+	void PutRun(BYTE *pDst, int ptype, int n, int r, int g, int b, int &x, int &y, int &lasti); //decoded run of I-frame
+	int GetPixelTypeBand(int x, int dy, BYTE* pSrc, BYTE* pSrclast, const int off);
+	bool PixelTypeFitsBand(int ptype, int x, int dy, BYTE *pSrc, BYTE* pSrclast, const int off);
+	void ClassifyBand(int myNum, int y0, int ysize, BYTE *pSrc); //runs and symbol counts of SC_STATIC_I band
+	void CodeBand(WorkerData &wd, BYTE *pSrc, bool counting);
+	void PutBandSymbol(WorkerData &wd, int model, int c, bool counting);
+	void FlushBand(WorkerData &wd); //rANS block of wd.ranges to wd.coded
+	int GetBandSymbol(RansState &rans, BYTE *&pSrc, int &nDec, int model);
+	void DecodeBand(BYTE *pSrc, BYTE *pDst, int y0, int ysize);
+	void StartSquad(); //worker threads and their data, on first use
+	void CountScratch(int nbands); //update scratchBytes and peakScratchBytes from tls[].runs
+	void CollectChangedRects(); //changedRects from bts[] of decoded P-frame
+	void ClassifyBlockP(BYTE *pSrc, WorkerData &wd, int sx1, int sy1, int sx2, int sy2);
 	void DecideBlockTypes(int by_start, int by_size, BYTE *pSrc, BlockRegion &rgn, int myNum);
 	virtual void RunCommand(int command, void *params, CSquadWorker *sqworker);
 
@@ -513,6 +737,67 @@ public:
 	virtual int DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int ftype);
 	virtual void SetupLossMask(int loss);
 	virtual void setCx6f0(int f0);
+	virtual void GetChangedRects(std::vector<FrameRect> &rects) { rects = changedRects; }
+	virtual void SetBitStats(BitStats *pStats) { ec.setStats(pStats); }
+	virtual void CountContextUsage(bool on);
+	virtual void GetContextUsage(ContextUsage &u);
+};
+
+struct TileJobParams {
+	BYTE *pFrame; // whole RGB24 frame
+	int ftype;
+};
+
+// Frame divided into square tiles, each one compressed by its own RGB24 codec
+// with its own statistics and entropy stream. Frame header contains sizes of tile streams,
+// so a decoder can decode just the tiles intersecting its viewport. Skipped tiles
+// become stale and stay so until their next I-frame.
+class CTiledScreenCapt : public IScreenCapt, public ISquadJob {
+	int myVersion;
+	CodecParameters tileParams;
+	int X, Y, stride, tsize, ntx, nty;
+	std::vector<IScreenCapt*> tiles;
+	std::vector< std::vector<BYTE> > tileImg; //RGB24 picture of each tile
+	std::vector< std::vector<BYTE> > tileData; //compressed data of each tile
+	std::vector<BYTE*> tileSrc; //when decoding: where tile data starts
+	std::vector<int> tileLen, tileType;
+	std::vector<int> flatClr; //when encoding: color of flat I stream last sent for each tile, -1 if not flat
+	std::vector<BYTE> stale; //tile skipped by decoder, its picture is out of date
+	std::vector<BYTE> decoded; //tile was decoded in last frame
+	BitStats *stats;
+	std::vector<BitStats> tileStats; //tiles are coded in parallel, each counts its own
+	bool countUsage;
+	FrameRect viewport;
+	CSquad *pSquad;
+	int nThreads, loss;
+	CRITICAL_SECTION tilesCritSec;
+	int nextTile;
+	std::vector<BYTE> saveBuffer; //frame that didn't fit into dstLength, returned by next CompressFrame
+	int last_ftype;
+
+	void CreateTiles(int tile_size);
+	void FreeTiles();
+	void GetTileRect(int t, FrameRect &rc);
+	int TileStride(int t);
+	int GrabTile(); //next tile for a worker thread, -1 if all done
+	void CopyTile(int t, BYTE *pFrame, bool toFrame);
+	virtual void RunCommand(int command, void *params, CSquadWorker *sqworker);
+
+public:
+	CTiledScreenCapt(int ver);
+	~CTiledScreenCapt();
+	virtual void Init(CodecParameters *pParams); 
+	virtual void Deinit();
+	virtual int CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype); //frame type 0-I, 1-P
+	virtual int DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int ftype);
+	virtual void SetupLossMask(int loss);
+	virtual void setCx6f0(int f0);
+	virtual void SetViewport(const FrameRect &rc);
+	virtual void GetStaleRects(std::vector<FrameRect> &rects);
+	virtual void GetChangedRects(std::vector<FrameRect> &rects);
+	virtual void SetBitStats(BitStats *pStats);
+	virtual void CountContextUsage(bool on);
+	virtual void GetContextUsage(ContextUsage &u);
 };
 
 //instance of a codec
@@ -527,8 +812,29 @@ class ScreenCodec {
 	bool crashed;
 	int redshift, greenshift, blueshift;
 	int last_loss;
-
-	void CreateCodec(int version); //init pSC, params must be filled in. version: 1 was for old RC, 2 for RCSub, 3 for ANS
+	bool tiled; //pSC is CTiledScreenCapt
+	FrameRect viewport;
+	IScreenCapt *pAlpha; //codec for alpha channel in RGBA mode, NULL otherwise
+	std::vector<BYTE> alpha_buffer; //alpha as RGB24 (A,A,A)
+	std::vector<BYTE> rgba_buffer; //RGBA frame being put together: rgb part, alpha part, 4 bytes of rgb size
+	int rgba_pending, rgba_pending_type; //size and type of RGBA frame that didn't fit into dstLength, 0 if none
+	int yuv; //SC_YUV_* or 0
+	int outScale; //decoded picture is written downscaled by 1<<outScale
+	std::vector<uint> rowSums; //box filter accumulator for downscaled output
+	bool collectStats;
+	BitStats frameStats, totalStats, alphaStats;
+	bool trackUsage;
+	ContextUsage usageSummary;
+
+	void FrameUsageDone(); //add last frame to usageSummary
+
+	void PackYUV(const BYTE *pSrc); //planes -> rgb_buffer
+	void UnpackYUV(BYTE *pDst); //rgb_buffer -> planes
+	void DownscaleOut(BYTE *pDst, int pitch); //rgb_buffer -> box filtered smaller picture
+
+	int CompressPart(IScreenCapt *p, BYTE *pSrc, int pos, int &ftype); //append frame of p to rgba_buffer at pos
+	int EncoderVersion() const; //bitstream version written for current params
+	void CreateCodec(int version, bool tiles, bool alpha); //init pSC, params must be filled in. version: 1 was for old RC, 2 for RCSub, 3 for ANS
 
 public:
 	ScreenCodec();
@@ -536,8 +842,36 @@ public:
 	void Init(CodecParameters *pParams); 
 	void Deinit();
 	int CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype, int loss); //frame type 0-I, 1-P
+	int SkipFrame(BYTE *pDst); //P-frame without changes instead of next frame, at most 6 bytes
 	int DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int pitch, int ftype);
 	void CrashHappened() { crashed = true; }
+	void SetViewport(int x, int y, int w, int h); //when decoding tiled video, decode only tiles visible in this area
+	void GetStaleRects(std::vector<FrameRect> &rects); //areas of last decoded frame skipped by the decoder
+	void GetChangedRects(std::vector<FrameRect> &rects); //areas of output that changed in last decoded frame, in output pixels
+	void SetOutputScale(int shift); //0 = full size, 1..3 = decode to 1/2, 1/4, 1/8 of width and height
+	void EnableBitStats(bool on); //account encoded bits by kind of data, v3+ streams
+	const BitStats& GetFrameBitStats() const { return frameStats; } //last compressed frame
+	const BitStats& GetTotalBitStats() const { return totalStats; } //all frames since EnableBitStats
+	void TrackContextUsage(bool on); //count context upgrades and raw bytes of every frame
+	void GetContextUsage(ContextUsage &u); //models held now and counters of last frame
+	const ContextUsage& GetContextUsageSummary() const { return usageSummary; } //peak memory and counters of all frames since TrackContextUsage
+};
+
+//bitrate cap: leaky bucket of compressed bytes drained at the target rate,
+//loss goes up when the bucket fills and back down when it empties
+class RateControl {
+	int budget; //bytes drained per frame, 0 = off
+	int bucket; //bytes not yet drained
+	int capacity; //one second of data
+	int loss; //current loss in bits
+	int hold, holdFrames; //frames to wait before changing loss again
+public:
+	RateControl() : budget(0), bucket(0), capacity(0), loss(0), hold(0), holdFrames(0) {}
+	void Init(uint bytes_per_sec, uint rate, uint scale); //frame rate is rate/scale
+	bool Enabled() const { return budget > 0; }
+	int NextLoss(int minLoss) const { return max(loss, minLoss); } //loss for next frame, not lower than minLoss
+	bool Overflow() const { return Enabled() && bucket > capacity; } //over the hard limit, drop next P-frame
+	void FrameDone(int size); //account compressed frame
 };
 
 #endif
\ No newline at end of file
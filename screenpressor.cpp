@@ -59,6 +59,11 @@ LRESULT CodecInst::Open(ICOPEN* icinfo) //returns inst_id - index in instances
 
 	CodecInst* pinst = new CodecInst();
 	instances.push_back(pinst);
+	if (pinst) {
+		Configuration conf;
+		conf.GetCurConfig();
+		pinst->trace_decoding = conf.Trace != 0;
+	}
 
 	if (icinfo) icinfo->dwError = pinst ? ICERR_OK : ICERR_MEMORY;
 
@@ -188,6 +193,11 @@ static INT_PTR CALLBACK ConfigureDialogProc(HWND hwndDlg, UINT uMsg, WPARAM wPar
 		CheckDlgButton(hwndDlg, IDC_LOSSBYHOST, conf.ForceLoss ? BST_UNCHECKED : BST_CHECKED);		
 		EnableWindow(GetDlgItem(hwndDlg, IDC_LOSS_SLIDER), conf.ForceLoss); 
 
+		static const char* presetNames[] = { "Ultrafast (live capture)", "Fast", "Default", "Maximum compression" };
+		for(int i=SC_PRESET_ULTRAFAST; i<=SC_PRESET_MAX; i++)
+			SendDlgItemMessage(hwndDlg, IDC_PRESET, CB_ADDSTRING, 0, (LPARAM)presetNames[i]);
+		SendDlgItemMessage(hwndDlg, IDC_PRESET, CB_SETCURSEL, min(conf.Preset, SC_PRESET_MAX), 0);
+
 		if (CheckCode(conf.email, conf.regcode))
 			ShowRegisteredStatus(hwndDlg, conf);
 #ifdef NOPROTECT
@@ -204,6 +214,7 @@ static INT_PTR CALLBACK ConfigureDialogProc(HWND hwndDlg, UINT uMsg, WPARAM wPar
 				conf.KeyFrameInterval = GetDlgItemInt(hwndDlg, IDC_INTERVAL, &parsed, FALSE);
 				conf.loss = 4 - SendMessage(GetDlgItem(hwndDlg, IDC_LOSS_SLIDER), TBM_GETPOS, 0, 0);
 				conf.ForceLoss = IsDlgButtonChecked(hwndDlg, IDC_LOSSBYHOST)==BST_UNCHECKED;
+				conf.Preset = SendDlgItemMessage(hwndDlg, IDC_PRESET, CB_GETCURSEL, 0, 0);
 				if (parsed)
 					conf.SetCurConfig();
 			case IDCANCEL:
@@ -247,9 +258,34 @@ DWORD CodecInst::Configure(HWND hwnd) {
 }
 
 
-DWORD CodecInst::GetState(LPVOID pv, DWORD dwSize) { return 0; }
+DWORD CodecInst::GetState(LPVOID pv, DWORD dwSize) 
+{ 
+	if (pv == NULL)
+		return sizeof(CodecState);
+	if (dwSize < sizeof(CodecState))
+		return ICERR_BADSIZE;
+	if (!has_state) {
+		Configuration conf;
+		conf.GetCurConfig();
+		state.preset = conf.Preset;
+		state.threads = conf.Threads;
+	}
+	memcpy(pv, &state, sizeof(CodecState));
+	return ICERR_OK; 
+}
 
-DWORD CodecInst::SetState(LPVOID pv, DWORD dwSize) { return 0; }
+DWORD CodecInst::SetState(LPVOID pv, DWORD dwSize) 
+{ 
+	if (pv == NULL) { //back to registry settings
+		has_state = false;
+		return 0;
+	}
+	if (dwSize < sizeof(CodecState))
+		return 0;
+	memcpy(&state, pv, sizeof(CodecState));
+	has_state = true;
+	return sizeof(CodecState); 
+}
 
 
 DWORD CodecInst::GetInfo(ICINFO* icinfo, DWORD dwSize) {
@@ -273,12 +309,56 @@ DWORD CodecInst::GetInfo(ICINFO* icinfo, DWORD dwSize) {
 }
 
 
+int CodecInst::YUVLayout(DWORD fourcc)
+{
+	switch(fourcc) {
+	case mmioFOURCC('I','4','2','0'):
+	case mmioFOURCC('I','Y','U','V'):
+	case mmioFOURCC('Y','V','1','2'): return SC_YUV_420P;
+	case mmioFOURCC('N','V','1','2'): return SC_YUV_NV12;
+	case mmioFOURCC('Y','V','2','4'): return SC_YUV_444P;
+	}
+	return 0;
+}
+
+//fourcc of YUV input stored after the header of compressed format, 0 for RGB streams
+DWORD CodecInst::StreamYUVFourcc(LPBITMAPINFOHEADER lpbiIn)
+{
+	if (lpbiIn->biBitCount==16 || lpbiIn->biSize != sizeof(BITMAPINFOHEADER) + 4)
+		return 0;
+	const DWORD fourcc = *(DWORD*)((BYTE*)lpbiIn + sizeof(BITMAPINFOHEADER));
+	return YUVLayout(fourcc) ? fourcc : 0;
+}
+
+//0 for same size output, 1..3 for output downscaled by 2, 4, 8, -1 for anything else
+int CodecInst::OutputScale(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbiOut)
+{
+	for(int s=0; s<=3; s++)
+		if (lpbiOut->biWidth == (lpbiIn->biWidth >> s) && lpbiOut->biHeight == (lpbiIn->biHeight >> s))
+			return s;
+	return -1;
+}
+
+DWORD CodecInst::YUVFrameSize(int layout, int width, int height)
+{
+	return layout==SC_YUV_444P ? width * height * 3 : width * height * 3 / 2;
+}
+
 bool CodecInst::CanCompress(LPBITMAPINFOHEADER lpbiIn) {
 	const DWORD fourcc = lpbiIn->biCompression;
 	const int bitcount = lpbiIn->biBitCount;
 	LOGN("CanCompress: in.BitCount=", bitcount);
 	LOGN("fourcc =", fourcc);
 
+	yuv = YUVLayout(fourcc);
+	if (yuv) {
+		if (yuv != SC_YUV_444P && ((lpbiIn->biWidth & 1) || (lpbiIn->biHeight & 1))) {
+			LOG("4:2:0 input needs even width and height, false");
+			return false;
+		}
+		return true;
+	}
+
 	if (fourcc == 0 || fourcc == ' BID' || fourcc == BI_BITFIELDS) { //uncompressed
 		if ((bitcount == 24) || (bitcount==32))
 			return true;
@@ -321,6 +401,8 @@ DWORD CodecInst::CompressGetFormat(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER
   int nextra = 0;
   if (lpbiIn->biBitCount==16)
 	  nextra = 12;//3 DWORDs for masks
+  if (yuv)
+	  nextra = 4;//input fourcc
 
   if (!lpbiOut)
     return sizeof(BITMAPINFOHEADER) + nextra;
@@ -328,6 +410,9 @@ DWORD CodecInst::CompressGetFormat(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER
   *lpbiOut = *lpbiIn;
   lpbiOut->biSize = sizeof(BITMAPINFOHEADER) + nextra;;
   lpbiOut->biCompression = FOURCC_SCPR;
+  if (yuv) {
+	*(DWORD*)((BYTE*)lpbiOut + sizeof(BITMAPINFOHEADER)) = lpbiIn->biCompression;
+  } else
   if (nextra) {
 	BYTE *extra = (BYTE*)lpbiOut + sizeof(BITMAPINFOHEADER);
 	DWORD *pdw = (DWORD*)extra;
@@ -374,11 +459,29 @@ DWORD CodecInst::CompressBegin(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpb
 	CodecParameters params;
 	params.width = lpbiIn->biWidth; params.height = lpbiIn->biHeight; params.bits_per_pixel = lpbiIn->biBitCount;
 	params.redmask = rmask; params.greenmask = gmask; params.bluemask = bmask;
-	params.high_range_x = 256; params.high_range_y = 256;
-	params.low_range_x = 8; params.low_range_y = 8;
+	SetSpeedPreset(&params, has_state ? state.preset : conf.Preset);
 	params.loss = conf.loss;
+	params.threads = has_state ? state.threads : conf.Threads;
+	params.tile_size = conf.TileSize;
+	params.adaptive_loss = conf.AdaptiveLoss;
+	params.alpha = conf.KeepAlpha;
+	params.yuv = yuv;
+	params.static_iframes = conf.StaticKeyFrames;
+	params.bitstream_v6 = conf.BitstreamV6;
 	
 	sc.Init(&params);
+	sc.EnableBitStats(conf.BitStats != 0);
+	sc.TrackContextUsage(conf.BitStats != 0);
+	bit_stats = conf.BitStats != 0;
+	if (conf.Trace && !traceOn) {
+		TraceStart();
+		tracing = true;
+	}
+	total_bytes = 0;
+	DWORD datarate = conf.MaxBitrate * 1000 / 8;
+	if (host_datarate > 0 && (datarate==0 || host_datarate < datarate))
+		datarate = host_datarate;
+	rc.Init(datarate, fps_rate, fps_scale);
 
 	return ICERR_OK;
 }
@@ -400,7 +503,7 @@ DWORD CodecInst::Compress(ICCOMPRESS* icinfo, DWORD dwSize) {
     BYTE* const out = (BYTE*)icinfo->lpOutput;
 
 	int ftype = 1;
-	bool forced_kf = force_interval && (npframes + 1 >= kf_interval);
+	bool forced_kf = force_interval && (npframes + 1 >= kf_interval) && !rc.Overflow(); //waits while over the cap
 	bool host_kf = !force_interval && (icinfo->dwFlags & ICCOMPRESS_KEYFRAME);
 	if (host_kf || forced_kf)
 		ftype = 0;
@@ -420,9 +523,17 @@ DWORD CodecInst::Compress(ICCOMPRESS* icinfo, DWORD dwSize) {
 		DWORD quality = min(icinfo->dwQuality, 10000);
 		loss = min( (10000 - quality)/2000, 4);
 	}
+	if (rc.Enabled())
+		loss = rc.NextLoss(loss);
 	//int ScreenCodec::CompressFrame(BYTE *pSrc, BYTE *pDst, int dstLength, int &ftype) //frame type 0-I, 1-P
 	//int sz = sc.CompressFrame(in, out, ftype, loss);
-	int sz = sc.CompressFrame(in, out, outBufSz, ftype, loss);
+	int sz;
+	if (ftype && rc.Overflow()) //over the data rate cap, decoder shows previous frame once more
+		sz = sc.SkipFrame(out);
+	else
+		sz = sc.CompressFrame(in, out, outBufSz, ftype, loss);
+	rc.FrameDone(sz);
+	total_bytes += sz;
 	if (!ftype) {
 		*icinfo->lpdwFlags = AVIIF_KEYFRAME; 
 		npframes = 0;
@@ -439,9 +550,43 @@ DWORD CodecInst::Compress(ICCOMPRESS* icinfo, DWORD dwSize) {
 }
 
 
+//timeline of this session goes to %TEMP%, other instances may record into it too
+void CodecInst::SaveTrace() {
+	if (!tracing) return;
+	char path[MAX_PATH];
+	GetTempPath(MAX_PATH - 40, path);
+	sprintf(path + strlen(path), "scpr_trace_%u.json", (unsigned)GetCurrentProcessId());
+	TraceSave(path);
+	tracing = false;
+}
+
 DWORD CodecInst::CompressEnd() {
 	LOG("CompressEnd");
+	if (bit_stats && sc.GetTotalBitStats().frames > 0) {
+		char path[MAX_PATH];
+		GetTempPath(MAX_PATH - 32, path);
+		strcat(path, "scpr_bitstats.txt");
+		FILE *f = fopen(path, "at");
+		if (f) {
+			sc.GetTotalBitStats().Print(f, (double)total_bytes);
+			sc.GetContextUsageSummary().Print(f);
+			fclose(f);
+		}
+		bit_stats = false;
+	}
 	sc.Deinit();
+	SaveTrace();
+	return ICERR_OK;
+}
+
+DWORD CodecInst::CompressFramesInfo(ICCOMPRESSFRAMES* icinfo) {
+	LOG("CompressFramesInfo");
+	fps_rate = icinfo->dwRate;
+	fps_scale = icinfo->dwScale;
+	host_datarate = icinfo->lDataRate > 0 ? icinfo->lDataRate : 0;
+	LOGN("rate =", fps_rate);
+	LOGN("scale =", fps_scale);
+	LOGN("datarate =", host_datarate);
 	return ICERR_OK;
 }
 
@@ -452,12 +597,21 @@ bool CodecInst::CanDecompress(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbi
 	    return (lpbiIn->biCompression == FOURCC_SCPR);
 	}
 
-	// must be 1:1 (no stretching)
-	if (lpbiOut && (lpbiOut->biWidth != lpbiIn->biWidth || lpbiOut->biHeight != lpbiIn->biHeight)) {
+	// must be 1:1 or a preview of 1/2, 1/4, 1/8 size (no other stretching)
+	if (lpbiOut && OutputScale(lpbiIn, lpbiOut) < 0) {
 		LOG("different width or height. false");
 	    return false;
 	}
 
+	const DWORD stream_yuv = StreamYUVFourcc(lpbiIn);
+	if (stream_yuv) { //YUV stream decodes only to the same YUV format and size
+		if (lpbiOut->biCompression != stream_yuv || OutputScale(lpbiIn, lpbiOut) != 0) {
+			LOG("YUV stream, out.compr differs. false");
+			return false;
+		}
+		return CanCompress(lpbiOut);
+	}
+
 	if ((lpbiIn->biBitCount>16) &&  (lpbiOut->biBitCount != 24) && (lpbiOut->biBitCount != 32)) {
 		LOG("in.bitcount > 16 and out.bitcount not 24 nor 32. false");
 		return false;
@@ -511,12 +665,24 @@ DWORD CodecInst::DecompressGetFormat(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEAD
 	int nextra = 0;
 	if (lpbiIn->biBitCount==16)
 		nextra = 12;
+	const DWORD stream_yuv = StreamYUVFourcc(lpbiIn);
+	if (stream_yuv)
+		nextra = 0;
 
 	if (lpbiOut == NULL) {
 		LOG("lpbiOut is null");
 		return sizeof(BITMAPINFOHEADER) + nextra;
 	}
 
+	if (stream_yuv) {
+		*lpbiOut = *lpbiIn;
+		lpbiOut->biSize = sizeof(BITMAPINFOHEADER);
+		lpbiOut->biPlanes = 1;
+		lpbiOut->biCompression = stream_yuv;
+		size_image = lpbiOut->biSizeImage = YUVFrameSize(YUVLayout(stream_yuv), lpbiIn->biWidth, lpbiIn->biHeight);
+		return ICERR_OK;
+	}
+
 	memcpy(lpbiOut, lpbiIn, sizeof(BITMAPINFOHEADER) + nextra); //masks copied also
   
 	lpbiOut->biSize = sizeof(BITMAPINFOHEADER) + nextra;
@@ -564,6 +730,12 @@ DWORD CodecInst::DecompressBegin(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER l
 
 	int stride = (lpbiIn->biWidth * bits / 8 + 3) & (~3);
 	size_image = stride * lpbiIn->biHeight;
+	yuv = YUVLayout(StreamYUVFourcc(lpbiIn));
+	if (yuv)
+		size_image = YUVFrameSize(yuv, lpbiIn->biWidth, lpbiIn->biHeight);
+	out_scale = OutputScale(lpbiIn, lpbiOut);
+	if (out_scale > 0)
+		size_image = ((lpbiOut->biWidth * lpbiOut->biBitCount / 8 + 3) & (~3)) * lpbiOut->biHeight;
 
 	CodecParameters params;
 	params.width = lpbiIn->biWidth; params.height = lpbiIn->biHeight; params.bits_per_pixel = bits;
@@ -571,8 +743,21 @@ DWORD CodecInst::DecompressBegin(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER l
 	params.high_range_x = 256; params.high_range_y = 256;
 	params.low_range_x = 8; params.low_range_y = 8;
 	params.loss = 0;
+	params.threads = 0;
+	params.tile_size = 0; //decoder learns it from the stream
+	params.adaptive_loss = 0;
+	params.alpha = 0; //decoder learns it from the stream
+	params.yuv = yuv;
+	params.static_iframes = 0;
+	params.bitstream_v6 = 0; //decoder learns version from the stream
 	
 	sc.Init(&params);
+	sc.SetOutputScale(out_scale);
+
+	if (trace_decoding && !traceOn) {
+		TraceStart();
+		tracing = true;
+	}
 	return ICERR_OK;
 }
 
@@ -614,7 +799,7 @@ DWORD CodecInst::Decompress(ICDECOMPRESS* icinfo, DWORD dwSize) {
 		LOGN("inferred ftype =",ftype);
 
 		int bits = icinfo->lpbiInput->biBitCount;
-		int stride = (icinfo->lpbiInput->biWidth * bits / 8 + 3) & (~3);
+		int stride = (icinfo->lpbiOutput->biWidth * bits / 8 + 3) & (~3);
 		LOGN("stride=",stride);
 		//DecompressFrame(BYTE *pSrc, int srcLength, BYTE *pDst, int pitch, int ftype)
 		sc.DecompressFrame(in, icinfo->lpbiInput->biSizeImage, out, stride, ftype);
@@ -645,6 +830,7 @@ DWORD CodecInst::DecompressEnd()
 {
 	LOG("DecompressEnd");
 	sc.Deinit();
+	SaveTrace();
 	decompressing = false;
 	return ICERR_OK;
 }
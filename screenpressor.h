@@ -5,6 +5,12 @@
 
 static const DWORD FOURCC_SCPR = mmioFOURCC('S','C','P','R');   // our compressed format
 
+// per-instance settings set by host with ICSetState, override the registry
+struct CodecState {
+	DWORD preset; // SC_PRESET_*
+	DWORD threads; // 0 = one per CPU
+};
+
 struct CodecInst {
 	static std::vector<CodecInst*> instances;
 	static LRESULT Open(ICOPEN* icinfo); //returns inst_id - index in instances
@@ -15,9 +21,19 @@ struct CodecInst {
 	ScreenCodec sc;
 
 	DWORD rmask, gmask, bmask;
+	int yuv; //SC_YUV_* layout of uncompressed frames, 0 = RGB
 	int npframes, kf_interval, conf_loss;
 	BOOL force_interval, force_loss;
 	int size_image; //stride * height, used for decompressing
+	int out_scale; //decoding to 1/2^out_scale size preview
+	bool bit_stats; //report where the bits went in CompressEnd
+	bool tracing; //recording timeline since CompressBegin or DecompressBegin, saved in the End
+	bool trace_decoding; //Trace registry value for decoders, read when the instance is opened
+	__int64 total_bytes; //compressed since CompressBegin
+	CodecState state;
+	bool has_state; //state was set by host
+	RateControl rc;
+	DWORD fps_rate, fps_scale, host_datarate; //from ICM_COMPRESS_FRAMES_INFO, data rate in bytes per second
 
 	// methods
 	BOOL QueryAbout();
@@ -37,6 +53,8 @@ struct CodecInst {
 	DWORD CompressGetSize(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbiOut);
 	DWORD Compress(ICCOMPRESS* icinfo, DWORD dwSize);
 	DWORD CompressEnd();
+	DWORD CompressFramesInfo(ICCOMPRESSFRAMES* icinfo);
+	void SaveTrace(); //write the timeline if this instance started recording
 
 
 	DWORD DecompressQuery(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbiOut);
@@ -47,6 +65,10 @@ struct CodecInst {
 	DWORD DecompressEnd();
 
 	bool CanCompress(LPBITMAPINFOHEADER lpbiIn);
+	static int YUVLayout(DWORD fourcc); //SC_YUV_* for supported YUV fourccs, 0 otherwise
+	static DWORD StreamYUVFourcc(LPBITMAPINFOHEADER lpbiIn); //YUV fourcc of compressed stream, 0 for RGB
+	static DWORD YUVFrameSize(int layout, int width, int height);
+	static int OutputScale(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbiOut); //0..3, -1 if not supported
 	bool CanDecompress(LPBITMAPINFOHEADER lpbiIn, LPBITMAPINFOHEADER lpbiOut);
 
 	int InferFrameType(BYTE first_byte, DWORD data_size); //0=I, 1=P, -1=error
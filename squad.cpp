@@ -5,6 +5,7 @@
 // Implementation of classes used to perform computations in parallel worker threads.
 
 #include "squad.h"
+#include "trace.h"
 
 DWORD WINAPI SquadWorkerThreadProc(LPVOID lpParameter)
 {
@@ -33,7 +34,7 @@ void CSquadWorker::GetSegment(int totalsize, int &segstart, int &segsize)
 /////////////////////////////////////////////////////////////////////
 
 //create a bunch of worker threads
-CSquad::CSquad(int nThreads)
+CSquad::CSquad(int nThreads, int stackSize)
 {
 	if (nThreads<1) 
 		nThreads = 1;
@@ -50,7 +51,7 @@ CSquad::CSquad(int nThreads)
 			ev_free[i] =  CreateEvent(NULL, TRUE/*manual*/, FALSE/*initial*/, NULL);
 			ev_havejob[i] = CreateEvent(NULL, FALSE/*auto*/, FALSE, NULL);
 			ev_sync[i] =    CreateEvent(NULL, FALSE/*auto*/, FALSE, NULL);
-			workers[i]->thread_handle = CreateThread(NULL,256*1024, SquadWorkerThreadProc, workers[i], 0, &tid);
+			workers[i]->thread_handle = CreateThread(NULL, stackSize, SquadWorkerThreadProc, workers[i], 0, &tid);
 		}
 	}
 }
@@ -102,6 +103,7 @@ void CSquad::SignalJob()
 void CSquad::Sync(int mynum)
 {
 	if (nw<2) return;	
+	CTraceScope ts("Sync wait");
 	if (mynum > 0) {
 		SignalObjectAndWait(ev_sync[mynum], ev_havejob[mynum], INFINITE, FALSE);
 	} else {
@@ -118,6 +120,7 @@ void CSquad::RunParallel(int command, void *params, ISquadJob *job)
 	cur_command = command;
 	cur_params = params;
 	cur_job = job;
+	CTraceScope ts("RunParallel", command);
 
 	if (nw>1) { //run in worker threads
 		WaitTillAllFree();
@@ -133,6 +136,7 @@ void CSquad::RunParallel(int command, void *params, ISquadJob *job)
 void CSquad::ThreadProc(CSquadWorker *sqworker)
 {	
 	const int mynum = sqworker->MyNum();
+	TraceThreadName("squad", mynum);
 	while(1) {
 		DWORD waitres = SignalObjectAndWait(ev_free[mynum], ev_havejob[mynum], INFINITE, FALSE);
 		if (waitres==WAIT_OBJECT_0) {//signaled
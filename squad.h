@@ -45,7 +45,7 @@ class CSquad {
 	void SignalJob(); //signal to workers they have a job
 
 public:
-	CSquad(int nThreads);
+	CSquad(int nThreads, int stackSize = 256*1024);
 	~CSquad();
 
 	int NumThreads() { return nw; }
@@ -57,122 +57,85 @@ BYTE* RangeCoderSub::Decode(uint cumFreq, uint freq, uint totFreq, BYTE* pSrc)
 		return pSrc;
 }
 
-//encode a value from a known range and update stats table, renormalizing stats if necessary
-BYTE* RangeCoderSub::EncodeVal(int c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pDst)
-{
-	uint cumfr=0,i;
+static inline int ValBlocks(uint maxc) { return maxc >= SUB_BLOCKED_MIN ? (maxc+15) >> 4 : 0; }
 
-	assert((c>=0) && (c<maxc) && (totfr>0));
-
-	for(i=0;i<c;i++)
-		cumfr += cnt[i];
-	pDst = Encode(cumfr, cnt[c], totfr, pDst);
-	cnt[c] += step;
-	totfr += step;
-	if (totfr>BOT_C) {
-		totfr = 0;
-		for(i=0;i<maxc;i++) {
-			cnt[i] = (cnt[i]>>1)+1;
-			totfr += cnt[i];
-		}
+//sums of blocks of 16 counts after the total
+static void BuildBlocks(uint *cnt, uint maxc)
+{
+	const int nb = ValBlocks(maxc);
+	uint *blk = cnt + maxc + 1;
+	for(int j=0; j<nb; j++) {
+		const uint end = min((uint)j*16+16, maxc);
+		blk[j] = 0;
+		for(uint i=j*16; i<end; i++)
+			blk[j] += cnt[i];
 	}
-	return pDst;
 }
 
-//decode a value from a known range and update stats table, renormalizing stats if necessary
-BYTE* RangeCoderSub::DecodeVal(int &c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pSrc)
+void RangeCoderSub::RenewVal(uint *cnt, uint maxc)
 {
-	uint value, cumfr, i;
-	
-	value = GetFreq(totfr);
-	for(cumfr=0,c=0; c<maxc; c++ ) {																					
-		if (value >= cumfr + cnt[c])													
-			cumfr += cnt[c];														
-		else																			
-	        break;																		
-	}																					
-	pSrc = Decode(cumfr, cnt[c], totfr, pSrc);
+	for(uint i=0; i<maxc; i++)
+		cnt[i] = 1;
+	cnt[maxc] = maxc;
+	BuildBlocks(cnt, maxc);
+}
 
+//count value c, halve all counts when total gets too big
+static inline void UpdateVal(int c, uint *cnt, uint &totfr, uint maxc, uint step)
+{
 	cnt[c] += step;
 	totfr += step;
+	if (ValBlocks(maxc))
+		cnt[maxc+1+(c>>4)] += step;
 	if (totfr>BOT_C) {
 		totfr = 0;
-		for(i=0;i<maxc;i++) {
+		for(uint i=0;i<maxc;i++) {
 			cnt[i] = (cnt[i]>>1)+1;
 			totfr += cnt[i];
 		}
+		BuildBlocks(cnt, maxc);
 	}
-	return pSrc;
 }
 
-//encode a value from range 0..255 with close to uniform distribution
-BYTE* RangeCoderSub::EncodeValUni(int c, uint *cnt, uint &totfr, uint step, BYTE *pDst)
+//encode a value from a known range and update stats table, renormalizing stats if necessary
+BYTE* RangeCoderSub::EncodeVal(int c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pDst)
 {
-	uint cumfr=0,i,x;
-	const int maxc = 256;
+	uint cumfr=0;
+	int i=0;
 
-	for(x=0;x<c/16;x++)
-		cumfr += cnt[256+x];
-	for(i=x*16;i<c;i++)
-		cumfr += cnt[i];
+	assert((c>=0) && (c<maxc) && (totfr>0));
 
-	pDst = Encode(cumfr, cnt[c], totfr, pDst);
-	cnt[c] += step;
-	cnt[256+x] += step;
-	totfr += step;
-	if (totfr>BOT_C) {
-		totfr = 0;
-		for(i=0;i<maxc;i++) {
-			cnt[i] = (cnt[i]>>1)+1;
-			totfr += cnt[i];
-		}
-		for(i=0;i<16;i++) {
-			cnt[256+i] = 0;
-			for(int j=0; j<16;j++)
-				cnt[256+i] += cnt[i*16+j];
-		}
+	if (ValBlocks(maxc)) { //whole blocks before c
+		const uint *blk = cnt + maxc + 1;
+		for(int j=0; j < c>>4; j++)
+			cumfr += blk[j];
+		i = c & ~15;
 	}
+	for(;i<c;i++)
+		cumfr += cnt[i];
+	pDst = Encode(cumfr, cnt[c], totfr, pDst);
+	UpdateVal(c, cnt, totfr, maxc, step);
 	return pDst;
 }
 
-//decode a value from range 0..255 with close to uniform distribution
-BYTE* RangeCoderSub::DecodeValUni(int &c, uint *cnt, uint &totfr, uint step, BYTE *pSrc)
+//decode a value from a known range and update stats table, renormalizing stats if necessary
+BYTE* RangeCoderSub::DecodeVal(int &c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pSrc)
 {
-	uint value, cumfr, i;
-	const int maxc = 256;
-	
-	value = GetFreq(totfr);
-
-	int x=0;
-	for(cumfr=0; x<16; x++ ) {
-		if (value >= cumfr + cnt[256 + x])
-			cumfr += cnt[256 + x];
-		else																			
-	        break;																		
-	}																					
-
-	c = x * 16;
-	for(; c<maxc; c++ ) {																					
-		if (value >= cumfr + cnt[c])													
-			cumfr += cnt[c];														
-		else																			
-	        break;																		
-	}																					
-	pSrc = Decode(cumfr, cnt[c], totfr, pSrc);
-	cnt[c] += step;
-	cnt[256+x] += step;
-	totfr += step;
-	if (totfr>BOT_C) {
-		totfr = 0;
-		for(i=0;i<maxc;i++) {
-			cnt[i] = (cnt[i]>>1)+1;
-			totfr += cnt[i];
-		}
-		for(i=0;i<16;i++) {
-			cnt[256+i] = 0;
-			for(int j=0; j<16;j++)
-				cnt[256+i] += cnt[i*16+j];
-		}
+	const uint value = GetFreq(totfr);
+	uint cumfr = 0;
+	c = 0;
+	const int nb = ValBlocks(maxc);
+	if (nb) { //find the block first, frequent values are usually in the first ones
+		const uint *blk = cnt + maxc + 1;
+		int j = 0;
+		while (j < nb-1 && value >= cumfr + blk[j])
+			cumfr += blk[j++];
+		c = j * 16;
 	}
+	const int last = (int)maxc - 1; //value is below totfr in a valid stream, so the search stops here at most
+	while (c < last && value >= cumfr + cnt[c])
+		cumfr += cnt[c++];
+	pSrc = Decode(cumfr, cnt[c], totfr, pSrc);
+	UpdateVal(c, cnt, totfr, maxc, step);
 	return pSrc;
-}
\ No newline at end of file
+}
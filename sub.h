@@ -17,6 +17,13 @@ typedef unsigned int uint;
 #define TOP_C         (1<<24)
 #define BOT_C         (1<<16)
 
+//Stats tables of EncodeVal/DecodeVal: maxc counts, their total at [maxc] and, for tables
+//of SUB_BLOCKED_MIN values or more, sums of 16-count blocks from [maxc+1]. Cumulative frequency
+//then takes up to maxc/16 block sums plus less than 16 counts, not up to maxc counts.
+//The counts and so the coded intervals are the same as with plain tables, v2 streams don't change.
+#define SUB_BLOCKED_MIN 64
+#define SUB_TABLE_SIZE(maxc) ((maxc) + 1 + ((maxc) >= SUB_BLOCKED_MIN ? ((maxc)+15)/16 : 0))
+
 class RangeCoderSub {
 	uint code, range, FFNum, Cache;
 public:
@@ -50,10 +57,10 @@ public:
 	BYTE* Decode(uint cumFreq, uint freq, uint totFreq, BYTE* pSrc);
 
 	////////////////////////////////////////////////////////
+	//totfr is cnt[maxc], table of SUB_TABLE_SIZE(maxc) entries filled by RenewVal
 	BYTE* EncodeVal(int c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pDst);
 	BYTE* DecodeVal(int &c, uint *cnt, uint &totfr, uint maxc, uint step, BYTE *pSrc);
-	BYTE* EncodeValUni(int c, uint *cnt, uint &totfr, uint step, BYTE *pDst);
-	BYTE* DecodeValUni(int &c, uint *cnt, uint &totfr, uint step, BYTE *pSrc);
+	static void RenewVal(uint *cnt, uint maxc); //all values equally probable
 
 };//class
 
@@ -0,0 +1,208 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// scprbatch: offline transcoder of AVI files to ScreenPressor,
+// key frame intervals are encoded in parallel by CGopEncoder.
+
+#include <windows.h>
+#include <vfw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gopenc.h"
+#include "conf.h"
+
+//Cx6 parameter of the codec working in current thread, the driver keeps it in a TLS slot of the DLL
+static __declspec(thread) int threadLocalInt = 0;
+void SetThreadLocalInt(int v) { threadLocalInt = v; }
+int GetThreadLocalInt() { return threadLocalInt; }
+
+static const DWORD FOURCC_SCPR = mmioFOURCC('S','C','P','R');
+
+//frames of the first video stream decoded by the installed VfW codecs,
+//each reader has its own stream and decompressor, so it goes through its GOP without seeking back
+class CAviReader : public IFrameReader {
+	PAVISTREAM ps;
+	PGETFRAME pgf;
+	LONG start;
+	uint frameSize;
+public:
+	CAviReader() : ps(NULL), pgf(NULL), start(0), frameSize(0) {}
+	~CAviReader() {
+		if (pgf) AVIStreamGetFrameClose(pgf);
+		if (ps) AVIStreamRelease(ps);
+	}
+	bool Open(const char *fname, BITMAPINFOHEADER *pbih) {
+		if (AVIStreamOpenFromFile(&ps, fname, streamtypeVIDEO, 0, OF_READ, NULL) != 0)
+			return false;
+		frameSize = pbih->biSizeImage;
+		pgf = AVIStreamGetFrameOpen(ps, pbih);
+		start = AVIStreamStart(ps);
+		return pgf != NULL;
+	}
+	virtual bool GetFrame(int n, BYTE *pDst) {
+		BITMAPINFOHEADER *pbih = (BITMAPINFOHEADER*)AVIStreamGetFrame(pgf, start + n);
+		if (!pbih) return false;
+		memcpy(pDst, (BYTE*)pbih + pbih->biSize + pbih->biClrUsed * 4, frameSize);
+		return true;
+	}
+};
+
+class CAviSource : public IFrameSource {
+	PAVISTREAM ps;
+	const char *name;
+	BITMAPINFOHEADER bih; //format readers decode to
+	LONG length;
+public:
+	CAviSource() : ps(NULL), name(NULL), length(0) {}
+	~CAviSource() {
+		if (ps) AVIStreamRelease(ps);
+	}
+	bool Open(const char *fname, int bits, BITMAPINFOHEADER *pbih) {
+		name = fname;
+		if (AVIStreamOpenFromFile(&ps, fname, streamtypeVIDEO, 0, OF_READ, NULL) != 0)
+			return false;
+		BYTE fmt[4096]; //header, masks or palette
+		LONG sz = sizeof(fmt);
+		if (AVIStreamReadFormat(ps, AVIStreamStart(ps), fmt, &sz) != 0)
+			return false;
+		const BITMAPINFOHEADER &in = *(BITMAPINFOHEADER*)fmt;
+		memset(pbih, 0, sizeof(BITMAPINFOHEADER));
+		pbih->biSize = sizeof(BITMAPINFOHEADER);
+		pbih->biWidth = in.biWidth; pbih->biHeight = abs(in.biHeight);
+		pbih->biPlanes = 1; pbih->biBitCount = bits; pbih->biCompression = BI_RGB;
+		pbih->biSizeImage = ((pbih->biWidth * bits / 8 + 3) & (~3)) * pbih->biHeight;
+		bih = *pbih;
+		length = AVIStreamLength(ps);
+		PGETFRAME pgf = AVIStreamGetFrameOpen(ps, pbih); //fail early if no codec can give this format
+		if (!pgf) return false;
+		AVIStreamGetFrameClose(pgf);
+		return true;
+	}
+	PAVISTREAM Stream() { return ps; }
+	virtual int NumFrames() { return length; }
+	virtual IFrameReader* OpenReader() {
+		CAviReader *r = new CAviReader();
+		if (!r->Open(name, &bih)) {
+			delete r;
+			return NULL;
+		}
+		return r;
+	}
+};
+
+class CAviSink : public IFrameSink {
+	PAVIFILE pf;
+	PAVISTREAM ps;
+	int total_frames;
+public:
+	CAviSink() : pf(NULL), ps(NULL), total_frames(0) {}
+	~CAviSink() {
+		if (ps) AVIStreamRelease(ps);
+		if (pf) AVIFileRelease(pf);
+	}
+	bool Open(const char *fname, PAVISTREAM src, BITMAPINFOHEADER *pbih, int nframes) {
+		total_frames = nframes;
+		DeleteFile(fname);
+		if (AVIFileOpen(&pf, fname, OF_CREATE | OF_WRITE, NULL) != 0)
+			return false;
+		AVISTREAMINFO si;
+		AVIStreamInfo(src, &si, sizeof(si));
+		si.fccHandler = FOURCC_SCPR;
+		si.dwSuggestedBufferSize = 0;
+		if (AVIFileCreateStream(pf, &ps, &si) != 0)
+			return false;
+		BITMAPINFOHEADER out = *pbih;
+		out.biCompression = FOURCC_SCPR;
+		return AVIStreamSetFormat(ps, 0, &out, sizeof(out)) == 0;
+	}
+	virtual bool PutFrame(int n, const BYTE *pData, int size, bool keyframe) {
+		if (n % 100 == 0)
+			fprintf(stderr, "\r%d / %d", n, total_frames);
+		return AVIStreamWrite(ps, n, 1, (LPVOID)pData, size, keyframe ? AVIIF_KEYFRAME : 0, NULL, NULL) == 0;
+	}
+};
+
+static void usage()
+{
+	printf("usage: scprbatch [options] input.avi output.avi\n"
+		" -k N   key frame interval (default: codec setting)\n"
+		" -t N   GOPs encoded at once (default: one per CPU)\n"
+		" -m N   memory for compressed data waiting to be written, MB (default 512)\n"
+		" -l N   loss in bits, 0..5 (default: codec setting)\n"
+		" -p N   speed preset 0..3 (default: codec setting)\n"
+		" -32    keep RGB32, with alpha if enabled in codec settings\n"
+		" -u     report memory and context model usage of one codec instance\n"
+		" -T F   write timeline of codec stages to F, Chrome trace JSON\n");
+}
+
+int main(int argc, char *argv[])
+{
+	Configuration conf;
+	conf.GetCurConfig();
+	int kf = conf.KeyFrameInterval, threads = 0, budget_mb = 512, loss = conf.loss, preset = conf.Preset, bits = 24;
+	bool reportUsage = false;
+	const char *fin = NULL, *fout = NULL, *traceName = NULL;
+	for(int i=1;i<argc;i++) {
+		if (!strcmp(argv[i], "-32")) bits = 32; else
+		if (!strcmp(argv[i], "-u")) reportUsage = true; else
+		if (!strcmp(argv[i], "-T") && i+1 < argc) traceName = argv[++i]; else
+		if (argv[i][0]=='-' && i+1 < argc) {
+			const int v = atoi(argv[i+1]);
+			switch(argv[i][1]) {
+			case 'k': kf = v; break;
+			case 't': threads = v; break;
+			case 'm': budget_mb = v; break;
+			case 'l': loss = v; break;
+			case 'p': preset = v; break;
+			default: usage(); return 1;
+			}
+			i++;
+		} else
+		if (!fin) fin = argv[i]; else
+		if (!fout) fout = argv[i]; else { usage(); return 1; }
+	}
+	if (!fin || !fout) { usage(); return 1; }
+
+	AVIFileInit();
+	int ret = 1;
+	{
+		CAviSource src;
+		CAviSink dst;
+		BITMAPINFOHEADER bih;
+		if (!src.Open(fin, bits, &bih)) {
+			printf("cannot read video from %s\n", fin);
+		} else
+		if (!dst.Open(fout, src.Stream(), &bih, src.NumFrames())) {
+			printf("cannot create %s\n", fout);
+		} else {
+			CodecParameters params;
+			memset(&params, 0, sizeof(params));
+			params.width = bih.biWidth; params.height = bih.biHeight; params.bits_per_pixel = bits;
+			SetSpeedPreset(&params, preset);
+			params.loss = loss;
+			params.tile_size = conf.TileSize;
+			params.adaptive_loss = conf.AdaptiveLoss;
+			params.alpha = bits==32 ? conf.KeepAlpha : 0;
+			params.static_iframes = conf.StaticKeyFrames;
+			params.bitstream_v6 = conf.BitstreamV6;
+			CGopEncoder enc(&params, kf, threads, (size_t)budget_mb << 20);
+			enc.TrackContextUsage(reportUsage);
+			const DWORD t0 = GetTickCount();
+			if (traceName) TraceStart();
+			const bool ok = enc.Run(&src, &dst);
+			if (traceName && !TraceSave(traceName))
+				printf("cannot create %s\n", traceName);
+			if (ok) {
+				printf("\r%d frames in %.1f s\n", src.NumFrames(), (GetTickCount() - t0) / 1000.0);
+				if (reportUsage)
+					enc.GetContextUsage().Print(stdout);
+				ret = 0;
+			} else
+				printf("\nfailed\n");
+		}
+	}
+	AVIFileExit();
+	return ret;
+}
@@ -0,0 +1,197 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// scprbench: runs synthetic screen scenes through ScreenCodec at several
+// resolutions and thread counts, prints speed and size as JSON.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "screencap.h"
+#include "synth.h"
+
+//Cx6 parameter of the codec working in current thread, the driver keeps it in a TLS slot of the DLL
+static __declspec(thread) int threadLocalInt = 0;
+void SetThreadLocalInt(int v) { threadLocalInt = v; }
+int GetThreadLocalInt() { return threadLocalInt; }
+
+struct BenchResult {
+	int frames, iframes;
+	double bytes, ibytes; //compressed, all frames and I-frames only
+	double enc[2], dec[2]; //seconds in ScreenCodec calls for I- and P-frames
+	bool exact; //decoded frames equal source
+	int dropped; //frames dropped by rate control
+	double maxSecond; //most bytes in 25 frames in a row
+	bool capped; //maxSecond within what RateControl promises
+};
+
+static double Now()
+{
+	static LARGE_INTEGER freq = { 0 };
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+}
+
+//frames are rendered outside of the timed calls, the codec sees them one by one like from a capture.
+//with a rate cap (bytes per second at 25 fps) frames are dropped and key frames wait like in the driver
+static void RunScene(int scene, int X, int Y, int threads, int nframes, int kf, int preset, int loss, int staticI, int cap, BenchResult &res)
+{
+	CSynthScreen synth(scene, X, Y);
+	const int stride = (X*3 + 3) & (~3);
+	std::vector<BYTE> raw(stride * Y), back(stride * Y), out(X * Y * 6 + 1024);
+
+	CodecParameters params;
+	memset(&params, 0, sizeof(params));
+	params.width = X; params.height = Y; params.bits_per_pixel = 24;
+	SetSpeedPreset(&params, preset);
+	params.loss = loss;
+	params.threads = threads;
+	params.static_iframes = staticI;
+	ScreenCodec enc, dec;
+	enc.Init(&params);
+	dec.Init(&params);
+
+	RateControl rc;
+	rc.Init(cap, 25, 1);
+	std::vector<int> sizes(nframes);
+	int sinceKey = 0, maxFrame = 0;
+	double second = 0; //bytes of last 25 frames
+
+	memset(&res, 0, sizeof(res));
+	res.exact = true;
+	for(int n=0; n<nframes; n++) {
+		synth.Render(n, &raw[0]);
+		int ftype = n % kf ? 1 : 0;
+		if (cap > 0)
+			ftype = n==0 || (sinceKey + 1 >= kf && !rc.Overflow()) ? 0 : 1;
+		const bool drop = ftype && rc.Overflow();
+		double t0 = Now();
+		const int sz = drop ? enc.SkipFrame(&out[0]) : enc.CompressFrame(&raw[0], &out[0], out.size(), ftype, rc.NextLoss(loss));
+		double t1 = Now();
+		rc.FrameDone(sz);
+		sinceKey = ftype ? sinceKey + 1 : 0;
+		res.dropped += drop;
+		sizes[n] = sz;
+		maxFrame = max(maxFrame, sz);
+		second += sz - (n >= 25 ? sizes[n-25] : 0);
+		res.maxSecond = max(res.maxSecond, second);
+		dec.DecompressFrame(&out[0], sz, &back[0], stride, ftype);
+		double t2 = Now();
+		res.enc[ftype] += t1 - t0;
+		res.dec[ftype] += t2 - t1;
+		res.bytes += sz;
+		if (ftype==0) {
+			res.iframes++;
+			res.ibytes += sz;
+		}
+		if (loss==0 && cap==0 && memcmp(&raw[0], &back[0], raw.size()))
+			res.exact = false;
+	}
+	res.frames = nframes;
+	res.capped = cap==0 || res.maxSecond <= 2.0 * cap + maxFrame;
+	enc.Deinit();
+	dec.Deinit();
+}
+
+static void PrintResult(FILE *f, int scene, int X, int Y, int threads, const BenchResult &r, bool first)
+{
+	const int pframes = r.frames - r.iframes;
+	const double enc = r.enc[0] + r.enc[1], dec = r.dec[0] + r.dec[1];
+	fprintf(f, "%s    {\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, \"frames\": %d, \"iframes\": %d,\n",
+		first ? "" : ",\n", CSynthScreen::SceneName(scene), X, Y, threads, r.frames, r.iframes);
+	fprintf(f, "     \"encode_fps\": %.2f, \"decode_fps\": %.2f, \"bytes_per_frame\": %.1f, \"bytes_per_iframe\": %.1f, \"bytes_per_pframe\": %.1f,\n",
+		enc > 0 ? r.frames / enc : 0, dec > 0 ? r.frames / dec : 0, r.bytes / r.frames,
+		r.iframes ? r.ibytes / r.iframes : 0, pframes ? (r.bytes - r.ibytes) / pframes : 0);
+	fprintf(f, "     \"ms\": {\"compress_i\": %.3f, \"compress_p\": %.3f, \"decompress_i\": %.3f, \"decompress_p\": %.3f},\n",
+		r.iframes ? r.enc[0] * 1000 / r.iframes : 0, pframes ? r.enc[1] * 1000 / pframes : 0,
+		r.iframes ? r.dec[0] * 1000 / r.iframes : 0, pframes ? r.dec[1] * 1000 / pframes : 0);
+	fprintf(f, "     \"dropped\": %d, \"max_bytes_per_sec\": %.0f, \"capped\": %s, \"exact\": %s}",
+		r.dropped, r.maxSecond, r.capped ? "true" : "false", r.exact ? "true" : "false");
+}
+
+static int ParseList(const char *s, std::vector<int> &v) //"1,2,4"
+{
+	v.clear();
+	while(*s) {
+		v.push_back(atoi(s));
+		while(*s && *s != ',') s++;
+		if (*s) s++;
+	}
+	return v.size();
+}
+
+static void usage()
+{
+	printf("usage: scprbench [options]\n"
+		" -s LIST  scenes, comma separated numbers (default: all)\n");
+	for(int i=0; i<SYN_SCENES; i++)
+		printf("           %d %s\n", i, CSynthScreen::SceneName(i));
+	printf(" -r LIST  resolutions WxH (default 1280x720,1920x1080)\n"
+		" -t LIST  thread counts, 0 = one per CPU (default 1,0)\n"
+		" -n N     frames per run (default 120)\n"
+		" -k N     key frame interval (default 60)\n"
+		" -p N     speed preset 0..3 (default 2)\n"
+		" -l N     loss in bits (default 0)\n"
+		" -i N     1 = I-frames in independent bands with static models (default 0)\n"
+		" -b N     data rate cap in bytes per second at 25 fps, 0 = off (default 0)\n"
+		" -o FILE  write JSON to FILE instead of stdout\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<int> scenes, threads, res;
+	for(int i=0; i<SYN_SCENES; i++)
+		scenes.push_back(i);
+	threads.push_back(1); threads.push_back(0);
+	const char *resList = "1280x720,1920x1080", *outName = NULL;
+	int nframes = 120, kf = 60, preset = SC_PRESET_DEFAULT, loss = 0, staticI = 0, cap = 0;
+	for(int i=1; i<argc; i++) {
+		if (argv[i][0] != '-' || i+1 >= argc) { usage(); return 1; }
+		const char *v = argv[++i];
+		switch(argv[i-1][1]) {
+		case 's': ParseList(v, scenes); break;
+		case 'r': resList = v; break;
+		case 't': ParseList(v, threads); break;
+		case 'n': nframes = max(atoi(v), 1); break;
+		case 'k': kf = max(atoi(v), 1); break;
+		case 'p': preset = atoi(v); break;
+		case 'l': loss = atoi(v); break;
+		case 'i': staticI = atoi(v); break;
+		case 'b': cap = max(atoi(v), 0); break;
+		case 'o': outName = v; break;
+		default: usage(); return 1;
+		}
+	}
+	for(const char *s = resList; *s; ) { //pairs of width, height
+		int w = 0, h = 0;
+		if (sscanf(s, "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+			res.push_back(w); res.push_back(h);
+		}
+		while(*s && *s != ',') s++;
+		if (*s) s++;
+	}
+
+	FILE *f = outName ? fopen(outName, "wt") : stdout;
+	if (!f) { printf("cannot create %s\n", outName); return 1; }
+	fprintf(f, "{\"frames\": %d, \"keyframe_interval\": %d, \"preset\": %d, \"loss\": %d, \"static_iframes\": %d, \"rate_cap\": %d, \"results\": [\n", nframes, kf, preset, loss, staticI, cap);
+	bool first = true, exact = true, capped = true;
+	for(size_t s=0; s<scenes.size(); s++)
+		for(size_t r=0; r+1<res.size(); r+=2)
+			for(size_t t=0; t<threads.size(); t++) {
+				BenchResult br;
+				RunScene(scenes[s], res[r], res[r+1], threads[t], nframes, kf, preset, loss, staticI, cap, br);
+				PrintResult(f, scenes[s], res[r], res[r+1], threads[t], br, first);
+				fflush(f);
+				first = false;
+				exact = exact && br.exact;
+				capped = capped && br.capped;
+			}
+	fprintf(f, "\n]}\n");
+	if (outName) fclose(f);
+	return !exact ? 2 : !capped ? 3 : 0;
+}
@@ -0,0 +1,277 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// Deterministic synthetic screen content for benchmarks, integer arithmetic only.
+
+#include "synth.h"
+
+static int Tri(int t, int range) //triangle wave 0..range..0 with period 2*range
+{
+	if (range <= 0) return 0;
+	t %= 2 * range;
+	return t < range ? t : 2 * range - t;
+}
+
+CSynthScreen::CSynthScreen(int scene_, int width, int height, uint seed_)
+: scene(scene_), X(width), Y(height), stride((width*3 + 3) & (~3)), seed(seed_), pFrame(NULL)
+{
+}
+
+const char* CSynthScreen::SceneName(int scene_)
+{
+	static const char *names[SYN_SCENES] = { "terminal", "drag", "slides", "cursor", "video", "sheet" };
+	return scene_ >= 0 && scene_ < SYN_SCENES ? names[scene_] : "unknown";
+}
+
+uint CSynthScreen::Hash(uint a, uint b) const
+{
+	uint h = a * 0x9E3779B1u ^ (b + 0x7F4A7C15u) * 0x85EBCA77u ^ seed * 0xC2B2AE3Du;
+	h ^= h >> 15; h *= 0x2C1B3C6Du;
+	h ^= h >> 12; h *= 0x297A2D39u;
+	return h ^ (h >> 15);
+}
+
+void CSynthScreen::Pixel(int x, int y, uint clr)
+{
+	if (x < 0 || y < 0 || x >= X || y >= Y) return;
+	BYTE *p = pFrame + (Y-1-y) * stride + x*3;
+	p[0] = clr & 255; p[1] = (clr >> 8) & 255; p[2] = (clr >> 16) & 255;
+}
+
+void CSynthScreen::FillRect(int x1, int y1, int x2, int y2, uint clr)
+{
+	x1 = max(x1, 0); y1 = max(y1, 0); x2 = min(x2, X); y2 = min(y2, Y);
+	for(int y=y1; y<y2; y++) {
+		BYTE *p = pFrame + (Y-1-y) * stride + x1*3;
+		for(int x=x1; x<x2; x++, p+=3) {
+			p[0] = clr & 255; p[1] = (clr >> 8) & 255; p[2] = (clr >> 16) & 255;
+		}
+	}
+}
+
+void CSynthScreen::Gradient(int x1, int y1, int x2, int y2, uint clr1, uint clr2)
+{
+	const int h = max(y2 - y1, 1);
+	for(int y=max(y1, 0); y<min(y2, Y); y++) {
+		const int t = y - y1;
+		uint clr = 0;
+		for(int sh=0; sh<24; sh+=8) {
+			const int a = (clr1 >> sh) & 255, b = (clr2 >> sh) & 255;
+			clr |= (uint)(a + (b - a) * t / h) << sh;
+		}
+		FillRect(x1, y, x2, y+1, clr);
+	}
+}
+
+//5x8 glyphs from a small alphabet so letters repeat like in real text,
+//ids 0..39 are letters, 40..49 digits; letters hash to a space now and then
+int CSynthScreen::Text(int x, int y, uint line, int nchars, uint clr)
+{
+	const bool digits = (line & 0x80000000u) != 0;
+	for(int i=0; i<nchars; i++, x += charW) {
+		const uint h = Hash(line, i);
+		if (!digits && h % 6 == 0) continue; //space
+		const uint glyph = Hash(digits ? 40 + h % 10 : h % 40, 0x5EED);
+		for(int gy=0; gy<8; gy++)
+			for(int gx=0; gx<5; gx++)
+				if ((glyph >> ((gy*5 + gx) & 31)) & 1)
+					Pixel(x + 1 + gx, y + 2 + gy, clr);
+	}
+	return x;
+}
+
+void CSynthScreen::Window(int x1, int y1, int x2, int y2, uint title_clr)
+{
+	FillRect(x1, y1, x2, y2, 0x707070);
+	FillRect(x1+1, y1+1, x2-1, y1+22, title_clr);
+	Text(x1 + 8, y1 + 5, Hash(title_clr), min(24, (x2-x1)/charW/2), 0xFFFFFF);
+	for(int b=0; b<3; b++) //buttons
+		FillRect(x2 - 22*(b+1), y1+4, x2 - 22*(b+1) + 16, y1+18, b==0 ? 0xE04343 : 0xD8D8D8);
+	FillRect(x1+1, y1+22, x2-1, y2-1, 0xFFFFFF);
+}
+
+void CSynthScreen::Terminal(int n)
+{
+	const int T = 8; //frames per line, about 4 characters per frame
+	const int rows = max(Y / charH, 1), cols = max(X / charW - 1, 2);
+	const int cur = n / T;
+	FillRect(0, 0, X, Y, 0x1E1E1E);
+	const int first = max(cur - rows + 1, 0);
+	for(int k=first; k<=cur; k++) {
+		const int y = (k - first) * charH;
+		const int len = 8 + Hash(k, 1) % (cols - 7);
+		const int typed = k < cur ? len : len * (n % T + 1) / T;
+		const bool prompt = Hash(k, 2) % 4 == 0;
+		int x = 0;
+		if (prompt)
+			x = Text(0, y, 0x80000000u | k, 4, 0x6A9955) + charW;
+		x = Text(x, y, k, min(typed, cols - x/charW), prompt ? 0xFFFFFF : 0xC0C0C0);
+		if (k == cur)
+			FillRect(x, y+1, x + charW, y + charH - 1, 0xC0C0C0); //block cursor
+	}
+}
+
+void CSynthScreen::Drag(int n)
+{
+	Gradient(0, 0, X, Y, 0x3A6EA5, 0x1C3A5A);
+	for(int i=0; i<6; i++) { //desktop icons with labels
+		const int y = 16 + i * 72;
+		FillRect(16, y, 48, y + 32, 0xF0C040 - i * 0x102010);
+		Text(8, y + 36, 100 + i, 6, 0xFFFFFF);
+	}
+	const int w = max(X / 2, 64), h = max(Y / 2, 48);
+	const int x = Tri(n * 7, max(X - w, 1)), y = Tri(n * 5, max(Y - h, 1));
+	FillRect(x + 6, y + 6, x + w + 6, y + h + 6, 0x101820); //shadow
+	Window(x, y, x + w, y + h, 0x2B579A);
+	for(int r=0; (r+1)*charH < h - 28; r++)
+		Text(x + 8, y + 28 + r*charH, 1000 + r, min(50, (w - 16) / charW) - (int)(Hash(r, 3) % 12), 0x202020);
+}
+
+static void SlideColors(uint h, uint &bg, uint &accent)
+{
+	static const uint bgs[4] = { 0xFFFFFF, 0xF3F2F1, 0x1F2A44, 0xFFF8E7 };
+	static const uint accents[4] = { 0xC43E1C, 0x2B579A, 0x217346, 0x7719AA };
+	bg = bgs[h % 4]; accent = accents[(h >> 4) % 4];
+}
+
+void CSynthScreen::Slides(int n)
+{
+	const int P = 40, transition = 10; //frames per slide, of them moving
+	const int s = n / P, t = n % P;
+	const int shift = t < P - transition ? 0 : X * (t - (P - transition) + 1) / transition;
+	for(int k=0; k<2; k++) {
+		const int slide = s + k, x0 = k * X - shift;
+		if (x0 >= X || x0 + X <= 0) continue;
+		uint bg, accent;
+		SlideColors(Hash(slide, 10), bg, accent);
+		const uint ink = bg==0x1F2A44 ? 0xFFFFFF : 0x202020;
+		FillRect(x0, 0, x0 + X, Y, bg);
+		FillRect(x0, 0, x0 + X, Y/8, accent);
+		Text(x0 + X/16, Y/16 - charH/2, Hash(slide, 11), min(30, X/charW/2), 0xFFFFFF);
+		for(int b=0; b<5; b++) { //bullets
+			const int y = Y/5 + b * charH * 2;
+			FillRect(x0 + X/16, y + 4, x0 + X/16 + 6, y + 10, accent);
+			Text(x0 + X/16 + 12, y, Hash(slide, 20 + b), 10 + Hash(slide, 30 + b) % 30, ink);
+		}
+		const int bx = x0 + X*5/8, by = Y*3/4, bw = X/40 + 1; //bar chart
+		for(int b=0; b<8; b++) {
+			const int bh = (int)(Hash(slide, 40 + b) % (Y/3 + 1)) + 4;
+			Gradient(bx + b*bw*2, by - bh, bx + b*bw*2 + bw, by, accent, accent | 0x404040);
+		}
+		FillRect(x0 + X*5/8 - 4, by, x0 + X*15/16, by + 2, ink);
+	}
+}
+
+void CSynthScreen::Cursor(int n)
+{
+	FillRect(0, 0, X, Y, 0xE8E8E8);
+	FillRect(0, 0, X, 26, 0xF3F3F3); //toolbar
+	for(int i=0; i<10; i++)
+		FillRect(8 + i*26, 5, 8 + i*26 + 18, 21, 0x9AA0A6 + (i & 1) * 0x202020);
+	const int px1 = X/8, px2 = X*7/8, lines = (Y - 40) / charH;
+	FillRect(px1, 32, px2, Y, 0xFFFFFF);
+	const int cols = max((px2 - px1 - 32) / charW, 2);
+	const int caretLine = min(lines / 2, lines - 1), typed = n / 16; //a character every 16 frames
+	int caretX = px1 + 16;
+	for(int r=0; r<lines; r++) {
+		const int y = 40 + r*charH;
+		if (r == caretLine) {
+			caretX = Text(px1 + 16, y, 5000, min(typed, cols - 1), 0x202020);
+			if ((n / 8) % 2 == 0)
+				FillRect(caretX, y + 1, caretX + 1, y + charH - 1, 0x000000);
+		} else
+			Text(px1 + 16, y, 2000 + r, cols - (int)(Hash(r, 4) % (cols/2 + 1)), 0x202020);
+	}
+}
+
+void CSynthScreen::Video(int n)
+{
+	FillRect(0, 0, X, Y, 0x202124);
+	Window(X/16, Y/16, X - X/16, Y - Y/16, 0x3C4043);
+	const int vx1 = X/8, vy1 = Y/8 + 16, vx2 = X - X/8, vy2 = Y - Y/6;
+	FillRect(vx1, vy2 + 8, vx2, vy2 + 12, 0xC0C0C0); //seek bar
+	FillRect(vx1, vy2 + 8, vx1 + (vx2 - vx1) * (n % 300) / 300, vy2 + 12, 0xFF0000);
+	//camera pans over smooth scenery with two moving blobs and sensor noise
+	const int bx1 = Tri(n * 4, max(vx2 - vx1, 1)), by1 = Tri(n * 3, max(vy2 - vy1, 1));
+	const int bx2 = Tri(n * 6 + 100, max(vx2 - vx1, 1)), by2 = Tri(n * 2 + 50, max(vy2 - vy1, 1));
+	const int r2 = (vy2 - vy1) * (vy2 - vy1) / 16 + 1;
+	for(int y=max(vy1, 0); y<min(vy2, Y); y++) {
+		BYTE *p = pFrame + (Y-1-y) * stride + max(vx1, 0)*3;
+		for(int x=max(vx1, 0); x<min(vx2, X); x++, p+=3) {
+			const int u = x - vx1 + n * 2, v = y - vy1;
+			int r = 90 + Tri(u + v, 120), g = 110 + Tri(u * 2 - v, 90), b = 140 + Tri(v * 3, 80);
+			const int dx1 = x - vx1 - bx1, dy1 = y - vy1 - by1, dx2 = x - vx1 - bx2, dy2 = y - vy1 - by2;
+			const int d1 = dx1*dx1 + dy1*dy1, d2 = dx2*dx2 + dy2*dy2;
+			if (d1 < r2) { r += (r2 - d1) * 100 / r2; g -= (r2 - d1) * 40 / r2; }
+			if (d2 < r2) { b += (r2 - d2) * 90 / r2; r -= (r2 - d2) * 50 / r2; }
+			const int noise = (int)(Hash(x + y * 4099, n) & 7) - 4;
+			p[0] = (BYTE)min(max(b + noise, 0), 255);
+			p[1] = (BYTE)min(max(g + noise, 0), 255);
+			p[2] = (BYTE)min(max(r + noise, 0), 255);
+		}
+	}
+}
+
+void CSynthScreen::Sheet(int n)
+{
+	const int cw = 10 * charW, ch = charH + 8, hx = 5 * charW, hy = 3 * ch;
+	const int cols = max((X - hx) / cw + 1, 1), rows = max((Y - hy) / ch + 1, 1);
+	FillRect(0, 0, X, Y, 0xFFFFFF);
+	FillRect(0, 0, X, ch, 0x217346); //ribbon
+	FillRect(0, ch, X, 2 * ch, 0xF3F3F3); //formula bar
+	FillRect(0, hy - ch, X, hy, 0xE6E6E6);
+	FillRect(0, hy, hx, Y, 0xE6E6E6);
+	for(int c=0; c<cols; c++) {
+		FillRect(hx + c*cw, hy - ch, hx + c*cw + 1, Y, 0xD4D4D4);
+		Text(hx + c*cw + cw/2 - charW/2, hy - ch + 4, 0x80000000u | (c + 7000), 1, 0x444444);
+	}
+	for(int r=0; r<rows; r++) {
+		FillRect(0, hy + r*ch, X, hy + r*ch + 1, 0xD4D4D4);
+		Text(4, hy + r*ch + 4, 0x80000000u | (r + 8000), 3, 0x444444);
+	}
+	//every 6 frames another cell is edited, its new value typed during the first 4
+	const int E = 6, e = n / E, t = n % E;
+	std::vector<uint> value(rows * cols);
+	for(int i=0; i<rows*cols; i++)
+		value[i] = Hash(i, 9000) % 3 ? (0x80000000u | Hash(i, 9001)) : 0; //0 = empty cell
+	int cell = 0;
+	for(int j=0; j<=e; j++) {
+		cell = (int)(Hash(j, 9002) % (uint)min(rows * cols, cols * 12));
+		if (j < e) value[cell] = 0x80000000u | Hash(j, 9003);
+	}
+	for(int i=0; i<rows*cols; i++) {
+		const int x = hx + (i % cols) * cw, y = hy + (i / cols) * ch;
+		if (i == cell) {
+			FillRect(x - 1, y - 1, x + cw + 2, y + ch + 2, 0x217346); //selection
+			FillRect(x + 1, y + 1, x + cw, y + ch, 0xFFFFFF);
+			if (t < 4) //being typed, also shown in formula bar
+				Text(x + 4, y + 4, 0x80000000u | Hash(e, 9003), 2 * (t + 1), 0x000000);
+			Text(hx + 8, ch + 4, 0x80000000u | Hash(e, 9003), t < 4 ? 2 * (t + 1) : 8, 0x000000);
+			if (t >= 4)
+				Text(x + 4, y + 4, 0x80000000u | Hash(e, 9003), 8, 0x000000);
+		} else
+		if (value[i])
+			Text(x + cw - 4 - 8*charW, y + 4, value[i], 8, 0x000000);
+	}
+}
+
+void CSynthScreen::Render(int n, BYTE *pDst)
+{
+	pFrame = pDst;
+	switch(scene) {
+	case SYN_TERMINAL: Terminal(n); break;
+	case SYN_DRAG: Drag(n); break;
+	case SYN_SLIDES: Slides(n); break;
+	case SYN_CURSOR: Cursor(n); break;
+	case SYN_VIDEO: Video(n); break;
+	case SYN_SHEET: Sheet(n); break;
+	default: FillRect(0, 0, X, Y, 0);
+	}
+	if (X & 3) { //DIB padding
+		const int pad = stride - X*3;
+		for(int y=0; y<Y; y++)
+			memset(pDst + y*stride + X*3, 0, pad);
+	}
+	pFrame = NULL;
+}
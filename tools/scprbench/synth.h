@@ -0,0 +1,52 @@
+#ifndef _SYNTH_H_
+#define _SYNTH_H_
+
+/*
+Synthetic screen content for benchmarks: typical desktop scenes rendered
+without GDI, fonts or randomness from the system, so every build on every
+machine produces the same frames. Frame n of a scene depends only on the
+scene, size, seed and n, frames can be rendered in any order.
+*/
+
+#include <windows.h>
+#include <vector>
+#include "defines.h"
+
+enum SynthScene {
+	SYN_TERMINAL, //text scrolling in a terminal, new lines typed char by char
+	SYN_DRAG, //window dragged over the desktop
+	SYN_SLIDES, //slides replaced by a push transition
+	SYN_CURSOR, //text editor, blinking caret and occasional typing
+	SYN_VIDEO, //video playing in a window of a static UI
+	SYN_SHEET, //spreadsheet, cells edited one by one, selection moves
+	SYN_SCENES
+};
+
+class CSynthScreen {
+	int scene, X, Y, stride;
+	uint seed;
+	BYTE *pFrame; //frame being rendered, RGB24 bottom-up DIB
+
+	uint Hash(uint a, uint b = 0) const; //deterministic noise
+	void Pixel(int x, int y, uint clr);
+	void FillRect(int x1, int y1, int x2, int y2, uint clr); //clipped
+	void Gradient(int x1, int y1, int x2, int y2, uint clr1, uint clr2); //vertical
+	int Text(int x, int y, uint line, int nchars, uint clr); //pseudo words of line number, returns x after text
+	void Window(int x1, int y1, int x2, int y2, uint title_clr); //frame, title bar and buttons
+
+	void Terminal(int n);
+	void Drag(int n);
+	void Slides(int n);
+	void Cursor(int n);
+	void Video(int n);
+	void Sheet(int n);
+
+public:
+	static const int charW = 7, charH = 12; //text cell
+
+	CSynthScreen(int scene_, int width, int height, uint seed_ = 1);
+	void Render(int n, BYTE *pDst); //frame n, stride (width*3+3)&~3
+	static const char* SceneName(int scene_);
+};
+
+#endif
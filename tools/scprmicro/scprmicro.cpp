@@ -0,0 +1,333 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// scprmicro: microbenchmarks of entropy coding primitives in isolation:
+// rANS put/advance, colour contexts of every kind, FixedSizeRansCtx and
+// the v2 range coder, driven by generated symbol streams of known shape.
+// Build with SC_NO_SIMD defined to time scalar searches of colour contexts.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "screencap.h"
+
+//Cx6 parameter of the codec working in current thread, the driver keeps it in a TLS slot of the DLL
+static __declspec(thread) int threadLocalInt = 0;
+void SetThreadLocalInt(int v) { threadLocalInt = v; }
+int GetThreadLocalInt() { return threadLocalInt; }
+
+struct Dist {
+	const char *name;
+	int alphabet; //number of different symbols
+	bool skewed; //geometric, last symbol ~1000 times rarer than first; otherwise uniform
+};
+
+static const Dist dists[] = {
+	{ "few", 3, true }, { "few", 3, false },
+	{ "small", 12, true }, { "small", 12, false },
+	{ "medium", 32, true }, { "medium", 32, false },
+	{ "full", 256, true }, { "full", 256, false },
+};
+
+struct MicroResult {
+	double enc, dec; //ns per symbol, best of runs
+	double bits; //per symbol
+	int kind; //colour context kind reached, 0 if not a colour context
+	bool ok; //decoded symbols match
+};
+
+static double Now()
+{
+	static LARGE_INTEGER freq = { 0 };
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+}
+
+//symbol ranks 0..alphabet-1, deterministic for given seed
+static void MakeRanks(const Dist &d, int n, std::vector<BYTE> &ranks)
+{
+	uint x = 12345;
+	const double r = pow(0.001, 1.0 / d.alphabet), lr = log(r);
+	ranks.resize(n);
+	for(int i=0; i<n; i++) {
+		int k;
+		do {
+			x = x * 1664525u + 1013904223u;
+			const double u = ((x >> 8) + 0.5) / (1 << 24);
+			k = d.skewed ? (int)(log(u) / lr) : (int)(u * d.alphabet);
+		} while (k >= d.alphabet);
+		ranks[i] = k;
+	}
+}
+
+static BYTE Spread(int rank) { return (rank * 37 + 11) & 255; } //colours are not adjacent values
+
+static double Bits(const Freq &fr) { return fr.freq ? PROB_BITS - log((double)fr.freq) / log(2.0) : 8; }
+
+//colour context: Context::encode gives interval or bypass, decoder gets a value inside the interval
+static void BenchContext(const std::vector<BYTE> &ranks, int nctx, MicroResult &res)
+{
+	const int n = ranks.size();
+	std::vector<BYTE> syms(n);
+	for(int i=0; i<n; i++)
+		syms[i] = Spread(ranks[i]);
+	std::vector<Freq> fr(n);
+	std::vector<char> coded(n);
+	std::vector<Context> enc(nctx), dec(nctx);
+	SetThreadLocalInt(32); //Cx6 f0 of v4
+
+	double t0 = Now();
+	for(int i=0; i<n; i++)
+		coded[i] = enc[i % nctx].encode(syms[i], fr[i]);
+	double t1 = Now();
+	int bad = 0;
+	for(int i=0; i<n; i++) {
+		Context &cx = dec[i % nctx];
+		BYTE c;
+		Freq f;
+		if (coded[i]) {
+			cx.decode(fr[i].cumFreq + fr[i].freq / 2, c, f);
+			bad += c != syms[i];
+		} else
+			cx.update(syms[i]);
+	}
+	double t2 = Now();
+
+	res.enc = min(res.enc, (t1 - t0) * 1e9 / n);
+	res.dec = min(res.dec, (t2 - t1) * 1e9 / n);
+	res.bits = 0;
+	for(int i=0; i<n; i++)
+		res.bits += coded[i] ? Bits(fr[i]) : 8;
+	res.bits /= n;
+	res.kind = enc[0].kind();
+	res.ok = res.ok && bad==0;
+	for(int i=0; i<nctx; i++) {
+		enc[i].free(); dec[i].free();
+	}
+}
+
+template<int NSym>
+static void BenchFixed(const std::vector<BYTE> &ranks, MicroResult &res)
+{
+	const int n = ranks.size();
+	std::vector<Freq> fr(n);
+	FixedSizeRansCtx<NSym> *enc = new FixedSizeRansCtx<NSym>, *dec = new FixedSizeRansCtx<NSym>;
+	enc->renew(false);
+	dec->renew(true);
+
+	double t0 = Now();
+	for(int i=0; i<n; i++)
+		enc->encode(ranks[i], fr[i]);
+	double t1 = Now();
+	int bad = 0;
+	for(int i=0; i<n; i++) {
+		Freq f;
+		bad += dec->decode(fr[i].cumFreq + fr[i].freq / 2, f) != ranks[i];
+	}
+	double t2 = Now();
+
+	res.enc = min(res.enc, (t1 - t0) * 1e9 / n);
+	res.dec = min(res.dec, (t2 - t1) * 1e9 / n);
+	res.bits = 0;
+	for(int i=0; i<n; i++)
+		res.bits += Bits(fr[i]);
+	res.bits /= n;
+	res.ok = res.ok && bad==0;
+	delete enc; delete dec;
+}
+
+//v3 contexts have Cx6 with f0=64, with many symbols it must still fit PROB_SCALE,
+//and so must Cx7 made from it, every symbol must come back exactly
+static bool CheckCx7Promotion()
+{
+	SetThreadLocalInt(64);
+	bool ok = true;
+	for(int dist=56; dist<=64; dist++) { //Cx2 of this many symbols becomes Cx6 on a repeat
+		Context enc, dec;
+		uint x = 777 + dist;
+		for(int i=0; i<20000; i++) {
+			x = x * 1664525u + 1013904223u;
+			const BYTE c = i < dist ? i * 4 : i == dist ? 0 : x >> 24; //then all 256 symbols, Cx6 -> Cx7
+			Freq fr;
+			if (enc.encode(c, fr)) {
+				BYTE d;
+				Freq f;
+				if (fr.cumFreq + fr.freq <= PROB_SCALE) {
+					dec.decode(fr.cumFreq + fr.freq / 2, d, f);
+					ok = ok && d == c;
+				} else { //interval beyond the scale can't be coded
+					dec.update(c);
+					ok = false;
+				}
+			} else
+				dec.update(c);
+		}
+		enc.free(); dec.free();
+	}
+	return ok;
+}
+
+//bare rANS with a static model, symbol found by a full slot table
+static void BenchRans(const std::vector<BYTE> &ranks, MicroResult &res)
+{
+	const int n = ranks.size();
+	uint cnt[256] = { 0 }, freq[256], cum[257];
+	for(int i=0; i<n; i++)
+		cnt[ranks[i]]++;
+	int total = 0, top = 0;
+	for(int s=0; s<256; s++) {
+		freq[s] = cnt[s] ? max((uint)((double)cnt[s] * PROB_SCALE / n), 1u) : 0;
+		total += freq[s];
+		if (freq[s] > freq[top]) top = s;
+	}
+	freq[top] += PROB_SCALE - total; //exact sum
+	std::vector<BYTE> slot(PROB_SCALE);
+	cum[0] = 0;
+	for(int s=0; s<256; s++) {
+		cum[s+1] = cum[s] + freq[s];
+		for(uint k=cum[s]; k<cum[s+1]; k++)
+			slot[k] = s;
+	}
+	std::vector<BYTE> buf(n * 2 + 64);
+
+	double t0 = Now();
+	RansState r;
+	RansEncInit(&r);
+	BYTE *ptr = &buf[0] + buf.size();
+	for(int i=n-1; i>=0; i--) //rANS is LIFO
+		RansEncPut(&r, &ptr, cum[ranks[i]], freq[ranks[i]], PROB_BITS);
+	RansEncFlush(&r, &ptr);
+	double t1 = Now();
+	const double bytes = &buf[0] + buf.size() - ptr;
+	int bad = 0;
+	RansDecInit(&r, &ptr);
+	for(int i=0; i<n; i++) {
+		const int s = slot[RansDecGet(&r, PROB_BITS)];
+		bad += s != ranks[i];
+		RansDecAdvance(&r, &ptr, cum[s], freq[s], PROB_BITS);
+	}
+	double t2 = Now();
+
+	res.enc = min(res.enc, (t1 - t0) * 1e9 / n);
+	res.dec = min(res.dec, (t2 - t1) * 1e9 / n);
+	res.bits = bytes * 8 / n;
+	res.ok = res.ok && bad==0;
+}
+
+//v2 range coder with its adaptive tables: run lengths are small values, colours are spread over the table
+static void BenchRC(const std::vector<BYTE> &ranks, bool colours, MicroResult &res)
+{
+	const int n = ranks.size();
+	const uint step = colours ? SC_STEP : SC_NSTEP;
+	std::vector<uint> ecnt(SUB_TABLE_SIZE(256)), dcnt(SUB_TABLE_SIZE(256));
+	RangeCoderSub::RenewVal(&ecnt[0], 256);
+	RangeCoderSub::RenewVal(&dcnt[0], 256);
+	std::vector<BYTE> buf(n * 2 + 64);
+	RangeCoderSub rc;
+
+	double t0 = Now();
+	rc.low = 0;
+	rc.EncodeBegin();
+	BYTE *p = &buf[0];
+	for(int i=0; i<n; i++) {
+		const int c = colours ? Spread(ranks[i]) : ranks[i];
+		p = rc.EncodeVal(c, &ecnt[0], ecnt[256], 256, step, p);
+	}
+	p = rc.EncodeEnd(p);
+	double t1 = Now();
+	const int len = p - &buf[0];
+	int bad = 0;
+	p = rc.DecodeBegin(&buf[0], len);
+	for(int i=0; i<n; i++) {
+		int c;
+		p = rc.DecodeVal(c, &dcnt[0], dcnt[256], 256, step, p);
+		bad += c != (colours ? Spread(ranks[i]) : ranks[i]);
+	}
+	double t2 = Now();
+
+	res.enc = min(res.enc, (t1 - t0) * 1e9 / n);
+	res.dec = min(res.dec, (t2 - t1) * 1e9 / n);
+	res.bits = len * 8.0 / n;
+	res.ok = res.ok && bad==0;
+}
+
+static void Report(FILE *f, bool json, bool &first, const char *prim, const Dist &d, const MicroResult &r)
+{
+	if (json)
+		fprintf(f, "%s  {\"primitive\": \"%s\", \"dist\": \"%s\", \"skewed\": %s, \"alphabet\": %d, \"kind\": %d, "
+			"\"encode_ns\": %.2f, \"decode_ns\": %.2f, \"bits\": %.3f, \"ok\": %s}",
+			first ? "" : ",\n", prim, d.name, d.skewed ? "true" : "false", d.alphabet, r.kind, r.enc, r.dec, r.bits, r.ok ? "true" : "false");
+	else {
+		char kind[8] = " - ";
+		if (r.kind) sprintf(kind, "Cx%d", r.kind);
+		fprintf(f, "%-10s %-7s %-8s %4d  %s  %8.2f  %8.2f  %6.3f%s\n", prim, d.name, d.skewed ? "skewed" : "uniform",
+			d.alphabet, kind, r.enc, r.dec, r.bits, r.ok ? "" : "  MISMATCH");
+	}
+	first = false;
+}
+
+static void usage()
+{
+	printf("usage: scprmicro [options]\n"
+		" -n N   symbols per run (default 4000000)\n"
+		" -r N   runs, best time is reported (default 3)\n"
+		" -c N   colour contexts the symbols are spread over (default 1, codec has 12288)\n"
+		" -j     JSON output\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int n = 4000000, runs = 3, nctx = 1;
+	bool json = false;
+	for(int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "-j")) { json = true; continue; }
+		if (argv[i][0] != '-' || i+1 >= argc) { usage(); return 1; }
+		const int v = atoi(argv[++i]);
+		switch(argv[i-1][1]) {
+		case 'n': n = max(v, 1000); break;
+		case 'r': runs = max(v, 1); break;
+		case 'c': nctx = max(v, 1); break;
+		default: usage(); return 1;
+		}
+	}
+
+	if (json)
+		printf("{\"symbols\": %d, \"contexts\": %d, \"results\": [\n", n, nctx);
+	else
+		printf("primitive  dist    shape    size  kind   enc ns    dec ns    bits\n");
+	bool first = true, ok = CheckCx7Promotion();
+	if (!ok) fprintf(stderr, "Cx6 -> Cx7 promotion with f0=64 decodes wrong symbols\n");
+	std::vector<BYTE> ranks;
+	for(size_t di=0; di < sizeof(dists)/sizeof(dists[0]); di++) {
+		const Dist &d = dists[di];
+		MakeRanks(d, n, ranks);
+		MicroResult r[6];
+		for(int k=0; k<6; k++) {
+			r[k].enc = r[k].dec = 1e30; r[k].kind = 0; r[k].ok = true;
+		}
+		for(int run=0; run<runs; run++) {
+			BenchRans(ranks, r[0]);
+			BenchContext(ranks, nctx, r[1]);
+			BenchFixed<256>(ranks, r[2]);
+			if (d.alphabet <= 6)
+				BenchFixed<6>(ranks, r[3]);
+			BenchRC(ranks, false, r[4]);
+			BenchRC(ranks, true, r[5]);
+		}
+		static const char *names[6] = { "rans", "context", "fixed256", "fixed6", "rc_run", "rc_colour" };
+		for(int k=0; k<6; k++) {
+			if (k==3 && d.alphabet > 6) continue;
+			Report(stdout, json, first, names[k], d, r[k]);
+			ok = ok && r[k].ok;
+		}
+	}
+	if (json)
+		printf("\n]}\n");
+	return ok ? 0 : 2;
+}
@@ -0,0 +1,249 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// scprvers: encodes the same synthetic scenes in every bitstream version,
+// decodes them back, checks they are bit exact, measures speed and ratio
+// and compares them with previous runs kept in a history file.
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include "screencap.h"
+#include "../scprbench/synth.h"
+
+//Cx6 parameter of the codec working in current thread, the driver keeps it in a TLS slot of the DLL
+static __declspec(thread) int threadLocalInt = 0;
+void SetThreadLocalInt(int v) { threadLocalInt = v; }
+int GetThreadLocalInt() { return threadLocalInt; }
+
+struct VersResult {
+	double bytes; //compressed, all frames
+	unsigned long long hash; //of compressed frames
+	double enc, dec; //seconds, best of repeats
+	bool exact;
+};
+
+//one line of history file
+struct HistRec {
+	char date[32], scene[32];
+	int width, height, frames, version, kf, threads, preset;
+	double bytes;
+	unsigned long long hash;
+	double encMBs, decMBs;
+};
+
+static double Now()
+{
+	static LARGE_INTEGER freq = { 0 };
+	if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return (double)t.QuadPart / freq.QuadPart;
+}
+
+static void Hash(unsigned long long &h, const BYTE *p, int len) //FNV-1a
+{
+	for(int i=0; i<len; i++) {
+		h ^= p[i];
+		h *= 1099511628211ull;
+	}
+}
+
+//codecs of given version driven directly, RGB24 like ScreenCodec passes to them
+static void RunVersion(int version, int scene, int X, int Y, int threads, int nframes, int kf, int preset, int repeats, VersResult &res)
+{
+	CSynthScreen synth(scene, X, Y);
+	const int stride = (X*3 + 3) & (~3);
+	std::vector<BYTE> raw(stride * Y), back(stride * Y);
+	std::vector<BYTE> data; //all compressed frames
+	std::vector<int> sizes(nframes), ftypes(nframes); //as encoder made them
+	std::vector<BYTE> out(X * Y * 6 + 1024);
+
+	CodecParameters params;
+	memset(&params, 0, sizeof(params));
+	params.width = X; params.height = Y; params.bits_per_pixel = 24;
+	SetSpeedPreset(&params, preset);
+	if (version < 3) //v2 codes vectors in this range, the driver always decodes it as 256
+		params.high_range_x = params.high_range_y = 256;
+	params.threads = threads;
+
+	memset(&res, 0, sizeof(res));
+	res.enc = res.dec = 1e30;
+	res.exact = true;
+	for(int r=0; r<repeats; r++) {
+		IScreenCapt *enc = CreateScreenCapt(version), *dec = CreateScreenCapt(version);
+		enc->Init(&params);
+		dec->Init(&params);
+		data.clear();
+		double tenc = 0, tdec = 0;
+		for(int n=0; n<nframes; n++) {
+			synth.Render(n, &raw[0]);
+			int ftype = n % kf ? 1 : 0;
+			double t0 = Now();
+			sizes[n] = enc->CompressFrame(&raw[0], &out[0], out.size(), ftype);
+			tenc += Now() - t0;
+			ftypes[n] = ftype;
+			data.insert(data.end(), out.begin(), out.begin() + sizes[n]);
+		}
+		//decoding is timed separately so both sides run with warm caches of their own
+		size_t pos = 0;
+		for(int n=0; n<nframes; n++) {
+			double t0 = Now();
+			dec->DecompressFrame(&data[pos], sizes[n], &back[0], ftypes[n]);
+			tdec += Now() - t0;
+			pos += sizes[n];
+			synth.Render(n, &raw[0]);
+			if (memcmp(&raw[0], &back[0], raw.size()))
+				res.exact = false;
+		}
+		enc->Deinit(); dec->Deinit();
+		delete enc; delete dec;
+		res.enc = min(res.enc, tenc);
+		res.dec = min(res.dec, tdec);
+	}
+	res.bytes = data.size();
+	res.hash = 14695981039346656037ull;
+	Hash(res.hash, &data[0], data.size());
+}
+
+static int LoadHistory(const char *fname, std::vector<HistRec> &hist)
+{
+	FILE *f = fopen(fname, "rt");
+	if (!f) return 0;
+	char line[512];
+	while(fgets(line, sizeof(line), f)) {
+		HistRec h;
+		if (sscanf(line, "%31[^,],%31[^,],%d,%d,%d,%d,%d,%d,%d,%lf,%llx,%lf,%lf", h.date, h.scene, &h.width, &h.height,
+			&h.frames, &h.version, &h.kf, &h.threads, &h.preset, &h.bytes, &h.hash, &h.encMBs, &h.decMBs) == 13)
+			hist.push_back(h);
+	}
+	fclose(f);
+	return hist.size();
+}
+
+//latest run of the same scene, size, frames, version and settings, or NULL
+static const HistRec* FindLast(const std::vector<HistRec> &hist, const HistRec &cur)
+{
+	for(int i=(int)hist.size()-1; i>=0; i--) {
+		const HistRec &h = hist[i];
+		if (!strcmp(h.scene, cur.scene) && h.width==cur.width && h.height==cur.height && h.frames==cur.frames && h.version==cur.version
+			&& h.kf==cur.kf && h.threads==cur.threads && h.preset==cur.preset)
+			return &h;
+	}
+	return NULL;
+}
+
+static int ParseList(const char *s, std::vector<int> &v) //"2,3,4"
+{
+	v.clear();
+	while(*s) {
+		v.push_back(atoi(s));
+		while(*s && *s != ',') s++;
+		if (*s) s++;
+	}
+	return v.size();
+}
+
+static void usage()
+{
+	printf("usage: scprvers [options]\n"
+		" -v LIST  bitstream versions, comma separated (default 2,3,4,6)\n"
+		" -s LIST  scenes, comma separated numbers (default: all)\n");
+	for(int i=0; i<SYN_SCENES; i++)
+		printf("           %d %s\n", i, CSynthScreen::SceneName(i));
+	printf(" -r WxH   resolution (default 1280x720)\n"
+		" -n N     frames per scene (default 60)\n"
+		" -k N     key frame interval (default 30)\n"
+		" -t N     worker threads, 0 = one per CPU (default 1)\n"
+		" -p N     speed preset 0..3 (default 2)\n"
+		" -b N     best of N repeats for speed (default 3)\n"
+		" -h FILE  history: compare with last run recorded there and append this one\n"
+		" -d N     speed drop in percent reported as regression (default 10)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<int> versions, scenes;
+	versions.push_back(2); versions.push_back(3); versions.push_back(4); versions.push_back(SC_VERSION);
+	for(int i=0; i<SYN_SCENES; i++)
+		scenes.push_back(i);
+	int X = 1280, Y = 720, nframes = 60, kf = 30, threads = 1, preset = SC_PRESET_DEFAULT, repeats = 3, maxDrop = 10;
+	const char *histName = NULL;
+	for(int i=1; i<argc; i++) {
+		if (argv[i][0] != '-' || i+1 >= argc) { usage(); return 1; }
+		const char *v = argv[++i];
+		switch(argv[i-1][1]) {
+		case 'v': ParseList(v, versions); break;
+		case 's': ParseList(v, scenes); break;
+		case 'r': if (sscanf(v, "%dx%d", &X, &Y) != 2 || X <= 0 || Y <= 0) { usage(); return 1; } break;
+		case 'n': nframes = max(atoi(v), 1); break;
+		case 'k': kf = max(atoi(v), 1); break;
+		case 't': threads = atoi(v); break;
+		case 'p': preset = atoi(v); break;
+		case 'b': repeats = max(atoi(v), 1); break;
+		case 'h': histName = v; break;
+		case 'd': maxDrop = atoi(v); break;
+		default: usage(); return 1;
+		}
+	}
+	for(size_t i=0; i<versions.size(); i++)
+		if (versions[i] < 2 || versions[i] > SC_VERSION || (versions[i] < 5 && (X > SC_V4_MAXSIZE || Y > SC_V4_MAXSIZE))) {
+			printf("version %d can't encode %dx%d\n", versions[i], X, Y);
+			return 1;
+		}
+
+	std::vector<HistRec> hist;
+	if (histName)
+		LoadHistory(histName, hist);
+	FILE *fh = histName ? fopen(histName, "at") : NULL;
+	if (histName && !fh) { printf("cannot write %s\n", histName); return 1; }
+	char date[32];
+	const time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M", localtime(&now));
+
+	const double rawMB = (double)X * Y * 3 * nframes / (1024*1024);
+	printf("%dx%d, %d frames, key frame every %d, %d threads, preset %d\n", X, Y, nframes, kf, threads, preset);
+	printf("scene      ver     ratio   enc MB/s   dec MB/s\n");
+	int mismatches = 0, regressions = 0;
+	for(size_t s=0; s<scenes.size(); s++)
+		for(size_t v=0; v<versions.size(); v++) {
+			VersResult r;
+			RunVersion(versions[v], scenes[s], X, Y, threads, nframes, kf, preset, repeats, r);
+			HistRec cur;
+			strcpy(cur.date, date);
+			strcpy(cur.scene, CSynthScreen::SceneName(scenes[s]));
+			cur.width = X; cur.height = Y; cur.frames = nframes; cur.version = versions[v];
+			cur.kf = kf; cur.threads = threads; cur.preset = preset;
+			cur.bytes = r.bytes; cur.hash = r.hash;
+			cur.encMBs = rawMB / max(r.enc, 1e-9);
+			cur.decMBs = rawMB / max(r.dec, 1e-9);
+			printf("%-10s  v%d  %8.2f  %9.2f  %9.2f%s\n", cur.scene, cur.version, rawMB * 1024*1024 / max(r.bytes, 1.0),
+				cur.encMBs, cur.decMBs, r.exact ? "" : "  MISMATCH");
+			if (!r.exact) mismatches++;
+
+			const HistRec *last = FindLast(hist, cur);
+			if (last) {
+				const double encDrop = 100 * (1 - cur.encMBs / last->encMBs), decDrop = 100 * (1 - cur.decMBs / last->decMBs);
+				if (encDrop > maxDrop || decDrop > maxDrop) {
+					printf("    slower than %s: encode %+.1f%%, decode %+.1f%%\n", last->date, -encDrop, -decDrop);
+					regressions++;
+				}
+				//encoder changes may alter streams of any version, the decoder must still read them
+				if (cur.hash != last->hash)
+					printf("    stream differs from %s: %.0f -> %.0f bytes\n", last->date, last->bytes, cur.bytes);
+				if (cur.bytes > last->bytes * 1.001)
+					regressions++;
+			}
+			if (fh && r.exact)
+				fprintf(fh, "%s,%s,%d,%d,%d,%d,%d,%d,%d,%.0f,%llx,%.3f,%.3f\n", cur.date, cur.scene, cur.width, cur.height,
+					cur.frames, cur.version, cur.kf, cur.threads, cur.preset, cur.bytes, cur.hash, cur.encMBs, cur.decMBs);
+		}
+	if (fh) fclose(fh);
+	if (mismatches) printf("%d runs not bit exact\n", mismatches);
+	if (regressions) printf("%d regressions\n", regressions);
+	return mismatches ? 2 : regressions ? 3 : 0;
+}
@@ -0,0 +1,121 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+// Recording of pipeline events and their output as Chrome trace JSON.
+
+#include "trace.h"
+#include <stdio.h>
+#include <vector>
+
+volatile bool traceOn = false;
+
+struct TraceRec {
+	const char *name;
+	DWORD tid;
+	LONGLONG t0, t1;
+	int arg;
+};
+
+struct TraceThread {
+	DWORD tid;
+	char name[32];
+};
+
+static const size_t maxTraceEvents = 1 << 20; //32 MB, later events are dropped
+
+//events of all threads go to one list, there are few of them per frame
+class CTraceLog {
+public:
+	CRITICAL_SECTION critsec;
+	std::vector<TraceRec> events;
+	std::vector<TraceThread> threads;
+	LONGLONG start;
+	int dropped;
+
+	CTraceLog() : start(0), dropped(0) { InitializeCriticalSection(&critsec); }
+	~CTraceLog() { DeleteCriticalSection(&critsec); }
+};
+
+static CTraceLog traceLog;
+
+LONGLONG TraceTime()
+{
+	LARGE_INTEGER t;
+	QueryPerformanceCounter(&t);
+	return t.QuadPart;
+}
+
+void TraceStart()
+{
+	EnterCriticalSection(&traceLog.critsec);
+	traceLog.events.clear();
+	traceLog.dropped = 0;
+	traceLog.start = TraceTime();
+	traceOn = true;
+	LeaveCriticalSection(&traceLog.critsec);
+}
+
+void TraceEvent(const char *name, LONGLONG t0, LONGLONG t1, int arg)
+{
+	if (!traceOn) return;
+	TraceRec r = { name, GetCurrentThreadId(), t0, t1, arg };
+	EnterCriticalSection(&traceLog.critsec);
+	if (traceLog.events.size() < maxTraceEvents)
+		traceLog.events.push_back(r);
+	else
+		traceLog.dropped++;
+	LeaveCriticalSection(&traceLog.critsec);
+}
+
+//threads are usually created before recording starts, so names are kept always
+void TraceThreadName(const char *name, int num)
+{
+	TraceThread th;
+	th.tid = GetCurrentThreadId();
+	if (num >= 0)
+		_snprintf(th.name, sizeof(th.name), "%s %d", name, num);
+	else
+		_snprintf(th.name, sizeof(th.name), "%s", name);
+	th.name[sizeof(th.name)-1] = 0;
+	EnterCriticalSection(&traceLog.critsec);
+	size_t i = 0;
+	while(i < traceLog.threads.size() && traceLog.threads[i].tid != th.tid) //thread ids get reused
+		i++;
+	if (i < traceLog.threads.size())
+		traceLog.threads[i] = th;
+	else
+		traceLog.threads.push_back(th);
+	LeaveCriticalSection(&traceLog.critsec);
+}
+
+bool TraceSave(const char *fname)
+{
+	EnterCriticalSection(&traceLog.critsec);
+	traceOn = false;
+	FILE *f = fopen(fname, "wt");
+	if (f) {
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		const double us = 1e6 / freq.QuadPart;
+		const DWORD pid = GetCurrentProcessId();
+		fprintf(f, "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"dropped\": %d}, \"traceEvents\": [\n", traceLog.dropped);
+		fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %u, \"args\": {\"name\": \"ScreenPressor\"}}", pid);
+		for(size_t i=0; i<traceLog.threads.size(); i++)
+			fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %u, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+				pid, traceLog.threads[i].tid, traceLog.threads[i].name);
+		for(size_t i=0; i<traceLog.events.size(); i++) {
+			const TraceRec &r = traceLog.events[i];
+			fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+				r.name, pid, r.tid, (r.t0 - traceLog.start) * us, (r.t1 - r.t0) * us);
+			if (r.arg >= 0)
+				fprintf(f, ", \"args\": {\"n\": %d}", r.arg);
+			fprintf(f, "}");
+		}
+		fprintf(f, "\n]}\n");
+		fclose(f);
+	}
+	traceLog.events.clear();
+	LeaveCriticalSection(&traceLog.critsec);
+	return f != NULL;
+}
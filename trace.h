@@ -0,0 +1,43 @@
+//---------------------------------------------------------------------------
+//  Part of ScreenPressor lossless video codec
+//  (C) Infognition Co. Ltd.
+//---------------------------------------------------------------------------
+#ifndef TRACE_H
+#define TRACE_H
+
+/*
+Timeline of the codec pipeline for chrome://tracing or ui.perfetto.dev.
+While recording is on, each stage of compression and decompression adds
+an event with its thread, start and duration: colour conversion, loss,
+every parallel command in every squad worker, the serial coding loops,
+rANS blocks on the rANS thread, and the waits at squad barriers and for
+the rANS thread to take a filled buffer. TraceSave() writes them in Chrome
+trace event JSON format. While it's off each stage costs a test of traceOn.
+Recording is process-wide, events of all codec instances go to one timeline.
+*/
+
+#include <windows.h>
+
+extern volatile bool traceOn; //set and cleared by any thread, read by all
+
+void TraceStart(); //forget old events, start recording
+bool TraceSave(const char *fname); //stop recording, write JSON, false if file can't be created
+LONGLONG TraceTime(); //performance counter ticks
+void TraceEvent(const char *name, LONGLONG t0, LONGLONG t1, int arg = -1); //name must be a static string
+void TraceThreadName(const char *name, int num = -1); //label of current thread, like "squad 2"
+
+//event lasting from construction till End() or end of scope
+class CTraceScope {
+	const char *name;
+	LONGLONG t0;
+	int arg;
+public:
+	CTraceScope(const char *name_, int arg_ = -1) : name(name_), t0(traceOn ? TraceTime() : 0), arg(arg_) {}
+	~CTraceScope() { End(); }
+	void End() {
+		if (t0) TraceEvent(name, t0, TraceTime(), arg);
+		t0 = 0;
+	}
+};
+
+#endif